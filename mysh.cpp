@@ -1,715 +1,5512 @@
-/* mysh.cpp - Shell program to execute a specific set of commands
- * 
- * Created by: Michael Bernhardt
- * Last updated: Oct 25, 2021
- * 
- * To compile - in bash shell, enter the following:
- * 			 g++ mysh.cpp -o mysh
- * 
- * To run - in bash shell, enter the following:
- * 			./mysh
- */
-
-#include <iostream>
-#include <fstream>
-#include <stack>
-#include <vector>
-#include <regex>
-#include <list>
-#include <unistd.h>
-#include <sys/wait.h>
-#include <sys/types.h>
-#include <signal.h>
-#include <dirent.h>
-#include <filesystem>
-#include <string>
-#include <cstdio>
-
-#define BUFFER_MAX 1024
-#define OUT_INDENT "  "
-
-using namespace std;
-
-// Give each valid command an integer representation
-typedef enum { movetodir_sym = 0, whereami_sym, history_sym, byebye_sym, replay_sym, start_sym,
-		background_sym, dalek_sym, repeat_sym, dalekall_sym,
-} command_syms;
-
-/*
- * Class: Command - Keep track of information for a given input command
- */
-class Command {
-	public:
-
-	const vector<string> KEYWORDS = {"movetodir", "whereami", "history", "byebye", "replay", "start",
-							"background", "dalek", "repeat", "dalekall"};
-	string cmdInput;						// Input string from user
-	string command;							// command string part of input
-	vector<string> tokenized{};				// vector of strings of tokenized input
-	vector<string> args{};					// vector of strings of args
-	int numTokens, replayNum, commandNum;    
-	
-
-	// Constructor
-	// Input: String input - string read from input
-	Command(string input) {
-		cmdInput = input;
-		tokenize();
-		numTokens = tokenized.size();
-		command = tokenized[0];
-		getCommandNum();
-		getArgs();
-	}
-
-	// Destructor
-	~Command() {
-		tokenized.clear();
-		args.clear();
-	}
-
-	void printHistory(vector<Command>);
-
-	// Tokenize the input string
-	void tokenize(){
-		int len = cmdInput.length();
-		char arr[len + 1];
-		strcpy(arr, cmdInput.c_str());
-		char* token;
-		char* rest = arr;
-
-		while ((token = strtok_r(rest, " ", &rest))) {
-			if (token) {
-				string s = token;
-				tokenized.insert(tokenized.end(), s);
-			}
-		}
-	}
-
-	// Combine the arguments into a single string
-	// Output: a string of arguments
-	string combineArgs () {
-		string combinedArgs = "";
-		if (numTokens < 2)
-			return combinedArgs;
-
-		int len = args.size();
-		for (int i = 0; i < len; i++)
-			combinedArgs += args[i] + " ";
-
-		return combinedArgs;
-	}
-
-	// Test if the command is a valid recognized command
-	// Output: bool - True: is valid
-	bool validCmd() {
-		return (commandNum >= 0 && hasCorrectNumArgs());
-	}
-	
-	// Test if the command has arguments
-	// Output: bool - True: has arguments
-	bool hasArgs() {
-		return !args.empty();
-	}
-	
-	// Test if the first argument is a given string
-	// Input: String arg - a string 
-	// Output: bool - True: is in arg
-	bool argsIs(string arg) {
-		return args[0] == arg;
-	}
-
-	private:
-
-	// Get and Set the commandNum based on the array of keywords
-	void getCommandNum() {
-		for (int i = 0; i < KEYWORDS.size(); i++) {
-			if (KEYWORDS[i] == command) {
-				commandNum = i;
-				return;
-			}
-		}
-		commandNum = -1;
-	}
-	
-	// Get and set the args of the command
-	void getArgs() {
-		for (int i = 1; i < numTokens; i++)
-			args.insert(args.end(), tokenized[i]);
-	}
-
-	// Check if the command has the correct number of arguments
-	// Return: bool - True: has correct number of arguments
-	bool hasCorrectNumArgs() {
-		int numArgs = args.size();
-
-		switch(commandNum) {
-			case movetodir_sym: // Move to given directory
-				return (numArgs == 1);
-			case whereami_sym:  // Print out current director
-				return (numArgs == 0);
-			case history_sym:   // Print out the current history stack
-				return (numArgs == 0 || numArgs == 1);
-			case byebye_sym:    // Set status to 0 and leave program
-				return (numArgs == 0);
-			case replay_sym:    // Replay a given Command from the history stack
-				return (numArgs == 1);
-			case start_sym:     // Start a program (with arguments), wait until it finishes
-				return (numArgs >= 1);
-			case background_sym:// Start a program (with arguments), do not wait for it to finish
-				return (numArgs >= 1);
-			case dalek_sym:		// End a process based on its pid
-				return (numArgs == 1);
-			case repeat_sym:	// Repeat a given command a given number of times
-				return (numArgs >= 2);
-			case dalekall_sym:  // End all processes currently running in shell
-				return (numArgs == 0);
-			default:
-				return false;
-		}
-	}
-};
-
-/*
- * Class: Command_Stack - Keep track of the history of valid commands entered in the shell
- */
-class Command_Stack {
-	private:
-
-	list<Command> historyStack;
-	string filename = "mysh_history.txt";
-
-	public:
-
-	// Using default Constructor
-	Command_Stack(){}
-
-	// Destructor
-	~Command_Stack() {
-		historyStack.clear();
-	}
-
-	// Print the current history stack to the console while setting the replay numbers for each command
-	void printHistory() {
-		list<Command>::iterator it;
-		int iter = 0;
-		int size = historyStack.size();
-		if (size == 0) return;
-		cout << OUT_INDENT << "History:" << endl;
-		for (it = historyStack.begin(); it != historyStack.end(); it++) {
-			it->replayNum = iter;
-			cout << OUT_INDENT << iter << ": " << it->cmdInput << endl;
-			iter++;
-		}
-	}
-	
-	// Get the replay number of a command in the stack
-	// Input: Command cmd - a Command to find in stack
-	// Output: the Command found, or Command("0") if not
-	Command findReplayNum(Command cmd) {
-		list<Command>::iterator it;
-		int size = historyStack.size();
-		if (size == 0) return Command("0");
-		for (it = historyStack.begin(); it != historyStack.end(); it++) {
-			int replayArg = stoi(cmd.args[0]);
-			if (replayArg == it->replayNum) {
-				if (it->commandNum == replay_sym) {
-					cout << OUT_INDENT << "Invalid Command: " << cmd.command << " " << it->cmdInput << endl;
-					break;
-				}
-				return *it;
-			}
-		}
-		
-		return Command("0");
-	}
-
-	// Read the history stack from a file
-	void readFromFile() {
-		ifstream fin(filename);
-		if (!fin.is_open()) return; // no file yet
-
-		string line, cmd;
-		list<string> cmdsIn;
-
-		if (fin.good()) {
-			while (getline(fin, line)) {
-				stringstream stream(line);
-
-				while (getline(stream, cmd, ',')) {
-					cmdsIn.push_back(cmd);
-				}
-			}
-		}
-
-		list<string>::iterator it;
-		for (it = cmdsIn.begin(); it != cmdsIn.end(); it++) {
-			historyStack.push_back(Command(*it));
-		}
-	}
-
-	// Print the current history stack to file
-	void printToFile() {
-		int numLines = historyStack.size();
-		if (numLines == 0) return;
-
-		list<Command>::iterator it;
-		ofstream fout;
-		fout.open(filename);
-		int i = 0;
-		for (it = historyStack.begin(); it != historyStack.end(); it++) {
-			fout << it->cmdInput;
-			if (i + 1 < numLines)
-				 fout << ',';
-			i++;
-		}
-		fout << endl;
-		fout.close();
-	}
-
-	// Get the size of the history stack
-	int size() {
-		return historyStack.size();
-	}
-
-	// Clear current history stack and delete history file
-	void clearHistory() {
-		while (!historyStack.empty())
-			historyStack.pop_front();
-		remove(filename.c_str());
-		cout << OUT_INDENT << "History Cleared" << endl;
-	}
-
-	// Push a command onto the history stack
-	// Input: Command c - a Command
-	void push(Command c) {
-		historyStack.push_front(c);
-	}
-
-	// Remove and return the last Command in the history stack
-	// Output: a Command
-	Command pop() {
-		Command c = (Command)(historyStack.back());
-		historyStack.pop_back();
-		return c;
-	}
-};
-
-/*-----------------------------------------------------------------------
-		End of Classes
------------------------------------------------------------------------*/
-
-// Function prototypes for main program
-void run_sh();
-string getInput();
-bool executeCommand(Command cmd);
-void start(Command cmd);
-int background(Command cmd);
-void whereami();
-bool moveToDir(Command cmd);
-void freeArgs(char** args, int argsn);
-void dalek(Command cmd);
-int findChildPid(int pid);
-void dalekall();
-void repeat(Command cmd);
-void introMessage();
-bool getHelp(Command cmd);
-
-// Global variables
-Command_Stack history;   // History command stack
-string currentdir;	     // The current working directory path
-int status;			     // The status of the program - 1: Run, 0: End
-vector<int> child_pids{};// The pids of the child processes currently running
-DIR* dir;
-struct dirent *entry;
-
-int main() {
-	status = 1; // Set status to run (1)
-
-	introMessage();
-
-	// Get command history from file mysh_history.txt
-	history.readFromFile();
-
-	run_sh();
-
-	// Print command history from file mysh_history.txt
-	history.printToFile();
-	
-	return 0;
-}
-
-// Run the shell until byebye entered or a fatal error occurs
-void run_sh() {
-	// Get the current directory
-	currentdir = get_current_dir_name();
-	currentdir += "/";
-
-	string inputString;
-
-	// Run the shell while the status continues
-	while (status) {
-		// Get the input from the shell console and make it a Command
-		inputString = getInput();
-		Command cmd(inputString);
-
-		// If help entered, list commands and continue loop
-		if (getHelp(cmd)) continue;
-		
-		// If the command is valid, execute it
-        bool validCmd = executeCommand(cmd);
-		
-		// Add to history if command is not byebye or a history clear
-        if (cmd.validCmd() && cmd.commandNum != byebye_sym && validCmd) {
-			if (cmd.hasArgs() && (cmd.commandNum != history_sym || !cmd.argsIs("-c")))
-				history.push(cmd);
-			else if (!cmd.hasArgs())
-				history.push(cmd);
-		}
-        else if (cmd.commandNum == byebye_sym) // status is now 0
-            break;
-        else								   // the command input is not recognized
-			cout << OUT_INDENT << "Invalid command: "<< cmd.cmdInput << endl;
-    }
-}
-
-
-// Execute a given command from the shell based on its command number
-// Input: Command cmd - The Command to execute
-// Output: bool - True: Command was executed successfully
-bool executeCommand(Command cmd) {
-	int c = cmd.commandNum;
-
-	// If command not valid, do not try to execute
-	if (!cmd.validCmd()) return false;
-
-	switch(c) {
-		case movetodir_sym: // Move to given directory
-			moveToDir(cmd);
-			break;
-		case whereami_sym:  // Print out current director
-			whereami();
-			break;
-		case history_sym:   // Print out the current history stack
-			if (cmd.numTokens == 1)
-				history.printHistory();
-			else if (cmd.numTokens == 2 && cmd.argsIs("-c"))
-				history.clearHistory();
-			else
-				return false;
-			break;
-		case byebye_sym:    // Set status to 0 and leave program
-			status = 0;
-			break;
-		case replay_sym:    // Replay a given Command from the history stack
-			executeCommand(history.findReplayNum(cmd));
-			break;
-		case start_sym:     // Start a program (with arguments), wait until it finishes
-			start(cmd);
-			break;
-		case background_sym:// Start a program (with arguments), do not wait for it to finish
-			background(cmd);
-			break;
-		case dalek_sym:		// End a process based on its pid
-			dalek(cmd);
-			break;
-		case repeat_sym:	// Repeat a given command a given number of times
-			repeat(cmd);
-			break;
-		case dalekall_sym:  // End all processes currently running in shell
-			dalekall();
-			break;
-		default:
-			return false;
-	}
-
-	return true;
-}
-
-// Repeat creating a background process a given number of times
-// Input: Command cmd - Command to repeat
-void repeat(Command cmd) {
-	const string BACKGROUND = "background";
-	int nTimes = stoi(cmd.args[0]);
-	
-	string args = "";
-	int numArgs = cmd.args.size();
-
-	// Create a string with the input of the command to repeat
-	for (int i = 1; i < numArgs; i++)
-		args += cmd.args[i] + " ";
-	string cmdStr = BACKGROUND + " " + args;
-	
-	// Create a command from that string
-	Command* rptCmd = new Command(cmdStr);
-
-	// Make sure newly created command is valid
-	if (!rptCmd->validCmd()) {
-		cout << OUT_INDENT << "Invalid Command: " << cmd.cmdInput << endl;
-		return;
-	}
-
-	// Store each new process' PID
-	int *pids = new int[nTimes];
-
-	for (int i = 0; i < nTimes; i++) 
-		pids[i] = background(*rptCmd);
-
-	delete(rptCmd);
-	delete(pids);
-}
-
-// Terminate a process
-// Input: Command cmd - The current Command
-void dalek(Command cmd) {
-	int pidToKill = stoi(cmd.args[0]);
-	int stat;
-	
-	// System call to tell child to wait to prevent it becoming zombie
-	waitpid(pidToKill, &stat, WNOHANG);
-
-	// Send signal to terminate process
-	kill(pidToKill, SIGTERM);
-	WIFSIGNALED(stat);
-	
-	// Remove pid from vector of child processes running
-	vector<int>::iterator it;
-	int idx = findChildPid(pidToKill);
-	int i = 0;
-	for (it = child_pids.begin(); it != child_pids.end(); it++, i++) {
-		if (i == idx) {
-			child_pids.erase(it);
-			break;
-		}
-	}
-
-	if (idx < 0)
-		cout << OUT_INDENT << "Could not terminate PID: " << pidToKill << endl;
-}
-
-// Terminate all child processes currently running
-void dalekall() {
-	int size = child_pids.size();
-	int* pids = new int[size];
-	for (int i = 0; i < size; i++) {
-		kill(child_pids[i], SIGTERM);
-		pids[i] = child_pids[i];
-	}
-	
-	child_pids.clear();
-
-	cout << OUT_INDENT << "Exterminating " << size << " processes:";
-	for (int i = 0; i < size; i++)
-		cout << " " << pids[i];
-	cout << endl;
-
-	delete(pids);
-}
-
-// Find a process id in vector of child processes
-// Output: index of the pid, or -1 if not found
-int findChildPid(int pid) {
-	int numChildren = child_pids.size();
-	int i;
-	for (i = 0; i < numChildren; i++) {
-		if (child_pids[i] == pid)
-			break;
-	}
-
-	return (i < numChildren) ? i : -1;
-}
-
-// Start given process in shell. To run program, precede program with ./
-// Wait until it finishes to resume shell
-// Input: Command cmd - The current Command
-void start(Command cmd) {
-	int numArgs = cmd.args.size();
-  	char* args[numArgs];
-	string programPath;
-	
-	// Convert the Command arguments into a null terminated array of char pointers
-	for (int i = 0; i < numArgs; i++)
-		args[i] = strdup((cmd.args[i].c_str()));
-	args[numArgs] = NULL;
-
-	// If multiple args, assume local directory
-	// If one arg, add currentdir for absolute path name
-	if (numArgs == 1)
-		programPath = currentdir + args[0];
-	else
-		programPath = args[0];
-		
-	int stat;
-
-	// Create a new process
-   	pid_t c_pid = fork();
-
-    if (c_pid == -1) {
-        cout << OUT_INDENT << "Failed forking child.." << endl;
-    }
-    else if (c_pid == 0) {
-		// Execute the program and arguments
-        if (execvp(programPath.c_str(), args) < 0) {
-            cout << OUT_INDENT << "Could not open: " << args[0] << endl;
-			freeArgs(args, numArgs);
-			exit(0); // exit the current process
-        }
-    }
-    else {
-		// Wait until the current child process is completed
-        waitpid(c_pid, &stat, 0);
-		freeArgs(args, numArgs);
-    }
-}
-
-
-// Start given process in shell. To run program, precede program with ./
-// Do not wait until it finishes to resume shell
-// Input: Command cmd - The current Command
-// Output: the pid of the child process
-int background(Command cmd) {
-	int numArgs = cmd.args.size();
-  	char* args[numArgs];
-	
-	// Convert the Command arguments into a null terminated array of char pointers
-	for (int i = 0; i < numArgs; i++)
-		args[i] = strdup((cmd.args[i].c_str()));
-	args[numArgs] = NULL;
-	
-	int stat;
-
-	// Create a new process, add it to child processes, and print to console
-   	pid_t c_pid = fork();
-	if (c_pid > 0) {
-		child_pids.push_back(c_pid);
-		cout << OUT_INDENT << "PID: " << c_pid << endl;
-	}
-	
-	// Fork did not execute
-    if (c_pid == -1) {
-        cout << OUT_INDENT << "Failed forking child.." << endl;
-    }
-
-	// Parent process executes program
-    else if (c_pid == 0) {
-		// Execute the program and arguments
-        if (execvp(args[0], args) < 0) {
-            cout << "Could not open: " << args[0] << endl;
-			freeArgs(args, numArgs);
-			exit(0); // exit the current process
-        }
-    }
-
-	// Child process action after execute
-    else {
-		// Semd signal to parent that child is still running
-		signal(SIGCHLD,SIG_IGN);
-        waitpid(c_pid, &stat, WNOHANG);
-		freeArgs(args, numArgs);
-    }
-
-	return c_pid;
-}
-
-// Get current location in directory
-void whereami() {
-	cout << currentdir << endl;
-}
-
-// Move to the new specified directory
-// Input: Command cmd - Command containing movetodir
-// Output: bool - True: Successfully changed directores
-bool moveToDir(Command cmd) {
-	
-	int count;
-	char path[BUFFER_MAX];
-	char* arg = strdup(cmd.args[0].c_str());
-	
-	if ((dir = opendir(arg)) == NULL) {
-		cout << OUT_INDENT << "Directory " << arg << ": not found" << endl;
-		free(arg);
-		return false;
-	}
-	else {
-		dir = opendir(arg);
-		if((entry = readdir(dir)) != NULL) {
-			if (arg[0] != '.' && arg[0] != '/') {
-				strcpy(path, get_current_dir_name());
-				strcat(path, "/");
-				strcat(path, arg);
-				strcat(path, "/");
-			}
-
-			// if directory specified is absolute, starting with "/"
-			else if (arg[0] == '/') {
-				strcat(path, arg);
-				strcat(path, "/");
-			}
-
-			// else not accepted as valid, 
-			else {
-				cout << OUT_INDENT << "Directory " << arg << ": not found" << endl;
-				free(arg);
-				return false;
-			}
-
-			string temp = path;
-			currentdir = temp;
-		}
-	}
-
-	if (arg != NULL)
-		free(arg);	
-	closedir(dir);	
-
-	return true;
-}
-
-// Delete tokens created to run process
-// Input: char** args - static array of char pointers
-//		  int argsn	  - number of arguments being deleted	  
-void freeArgs(char** args, int argsn) {
-	if (argsn == 0) return;
-	else if (argsn == 1) delete(args[0]);
-	else {
-		for (int i = 0; i < argsn; i++) {
-			if (args[i] != NULL)
-				delete(args[i]);
-		}
-	}
-}
-
-// Check if help was entered. If so, print command list
-// Input: Command cmd - Command to check if help was input
-// Output: bool - true if help entered
-bool getHelp(Command cmd) {
-	if (cmd.cmdInput == "help") {
-		cout << endl;
-		cout << OUT_INDENT << "The following are valid commands:" << endl;
-
-		for (string s: cmd.KEYWORDS)
-			cout << OUT_INDENT << s << endl;
-
-		cout << endl;
-		return true;
-	}
-
-	return false;
-}
-
-// Print out message at program start
-void introMessage() {
-	cout << "\t\t===== Welcome to my shell =====" << endl;
-	cout << "Type \"help\" to list valid commands\n" << endl;
-}
-
-// Get input from the shell console
-// Output: string - the line read
-string getInput() {
-	// Use a buffer to prevent overly large input
-	char buffer[BUFFER_MAX];
-	
-	cout << "# ";
-	cin.getline(buffer, BUFFER_MAX);
-
-	return string(buffer);
-}
+/* mysh.cpp - Shell program to execute a specific set of commands
+ * 
+ * Created by: Michael Bernhardt
+ * Last updated: Oct 25, 2021
+ * 
+ * To compile - in bash shell, enter the following:
+ * 			 g++ mysh.cpp -o mysh
+ * 
+ * To run - in bash shell, enter the following:
+ * 			./mysh
+ *
+ * To run a script of commands without prompts, enter either of:
+ * 			./mysh -f script.mysh
+ * 			./mysh < script.mysh
+ */
+
+#include <iostream>
+#include <fstream>
+#include <stack>
+#include <vector>
+#include <regex>
+#include <list>
+#include <deque>
+#include <unordered_map>
+#include <unistd.h>
+#include <sys/wait.h>
+#include <sys/types.h>
+#include <signal.h>
+#include <filesystem>
+#include <string>
+#include <cstring>
+#include <sstream>
+#include <cstdio>
+#include <climits>
+#include <string_view>
+#include <charconv>
+#include <memory>
+#include <cstdint>
+#include <iomanip>
+#include <algorithm>
+#include <spawn.h>
+#include <fcntl.h>
+#include <sys/stat.h>
+#include <sys/mman.h>
+#include <poll.h>
+#include <sys/syscall.h>
+#include <sys/epoll.h>
+#include <sys/signalfd.h>
+#include <sys/resource.h>
+#include <time.h>
+#include <sched.h>
+#include <termios.h>
+#include <sys/ioctl.h>
+#include <sys/inotify.h>
+#include <dirent.h>
+#include <sys/sendfile.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <arpa/inet.h>
+#include <linux/sched.h>
+#include <linux/mempolicy.h>
+
+#define BUFFER_MAX 1024
+#define OUT_INDENT "  "
+#define EXIT_LOG_MAX 256
+#define HISTSIZE 1000
+#define ARENA_MIN_COMPACT 65536
+#define HISTORY_HEADER "#mysh-history 2"
+#define BUILTIN_SLOTS 64
+#define ARGS_ANY -1
+#define TEE_CHUNK (1 << 20)
+#define SCRIPT_CHUNK (1 << 16)
+#define KILL_GRACE_MS 1000
+#define COMPLETE_LIST_MAX 100
+#define TRACE_BUFFER 4096
+#define OUTPUT_BUFFER (1 << 16)
+#define DAEMON_FRAME_MAX (1 << 16)
+#define CACHE_MAX_DEFAULT (256LL << 20)
+#define STATS_HEADER "PID      Status  Wall(s)   User(s)    Sys(s)  MaxRSS(KB)  Faults  Switches  Command"
+
+#ifndef PIDFD_SIGNAL_PROCESS_GROUP
+#define PIDFD_SIGNAL_PROCESS_GROUP (1UL << 2)
+#endif
+
+using namespace std;
+
+// Give each valid command an integer representation
+typedef enum { movetodir_sym = 0, whereami_sym, history_sym, byebye_sym, replay_sym, start_sym,
+		background_sym, dalek_sym, repeat_sym, dalekall_sym, jobs_sym, rehash_sym, stats_sym, bench_sym,
+		fg_sym, bg_sym, run_sym,
+} command_syms;
+
+class Command;
+struct Daemon_Client;
+struct Graph_Job;
+
+bool parseSize(string_view s, long long* n);
+string joinArgs(char** args);
+
+// Options of start, background and repeat that are not followed by a value,
+// every other --option takes one
+constexpr string_view SPAWN_FLAGS[] = {"--quiet", "--cache"};
+
+// Test if an option of start, background or repeat is followed by a value
+// Input: string_view opt - the option
+// Output: bool - True: the next word is its value
+constexpr bool optionTakesValue(string_view opt) {
+	for (string_view flag: SPAWN_FLAGS)
+		if (opt == flag) return false;
+	return true;
+}
+
+// Handlers of the built-in commands
+// Input: const Command& cmd - the Command to run
+// Output: bool - True: Command was executed successfully
+bool runMoveToDir(const Command& cmd);
+bool runWhereami(const Command& cmd);
+bool runHistory(const Command& cmd);
+bool runByebye(const Command& cmd);
+bool runReplay(const Command& cmd);
+bool runStart(const Command& cmd);
+bool runBackground(const Command& cmd);
+bool runDalek(const Command& cmd);
+bool runRepeat(const Command& cmd);
+bool runDalekall(const Command& cmd);
+bool runJobs(const Command& cmd);
+bool runRehash(const Command& cmd);
+bool runStats(const Command& cmd);
+bool runBench(const Command& cmd);
+bool runFg(const Command& cmd);
+bool runBg(const Command& cmd);
+bool runRun(const Command& cmd);
+
+/*
+ * Struct: Builtin - Name, argument counts, help text and handler of a built-in command
+ */
+struct Builtin {
+	const char* name;
+	int minArgs;							// Fewest arguments accepted
+	int maxArgs;							// Most arguments accepted, or ARGS_ANY
+	const char* help;						// One line description for help
+	bool daemonSafe;						// True: clients of mysh --daemon may run it
+	bool (*handler)(const Command&);
+};
+
+// Every built-in command, indexed by its command_syms value
+constexpr Builtin BUILTINS[] = {
+	{"movetodir",  1, 1,        "movetodir DIR - Move to the given directory",                  false, runMoveToDir},
+	{"whereami",   0, 0,        "whereami - Print the current directory",                       true,  runWhereami},
+	{"history",    0, 1,        "history [-c] - Print the command history, -c clears it",       false, runHistory},
+	{"byebye",     0, 0,        "byebye - Leave the shell",                                     false, runByebye},
+	{"replay",     1, 1,        "replay N - Run command N from the history again",              false, runReplay},
+	{"start",      1, ARGS_ANY, "start [--cache [--in FILE]...] [--pipesz SIZE] PROG [ARGS] [| PROG [ARGS]]... - Run programs and wait, --cache replays the output of an identical earlier run",  false, runStart},
+	{"background", 1, ARGS_ANY, "background [--quiet] [--pipesz SIZE] [--cpus L] [--numa N] [--cgroup C [--mem SIZE]] PROG [ARGS] [| PROG [ARGS]]... - Run programs", true,  runBackground},
+	{"dalek",      1, 1,        "dalek PID - Terminate a process started by the shell",         true,  runDalek},
+	{"repeat",     2, ARGS_ANY, "repeat [-j N] [OPTIONS] COUNT PROG [ARGS] - Run a program COUNT times, OPTIONS as for background, {i} in ARGS is the run 0..COUNT-1 and {n} is COUNT", true,  runRepeat},
+	{"dalekall",   0, 2,        "dalekall [--timeout T] - Terminate every process started by the shell, killing stragglers after T", true,  runDalekall},
+	{"jobs",       0, 0,        "jobs - List running and recently finished processes",          true,  runJobs},
+	{"rehash",     0, 0,        "rehash - Forget the cached locations of programs in PATH",     true,  runRehash},
+	{"stats",      0, 1,        "stats [PID | --summary] - Show resources used by processes",   true,  runStats},
+	{"bench",      2, ARGS_ANY, "bench N CMD [ARGS] | --pipeline N [LINE] - Time a command",    false, runBench},
+	{"fg",         0, 1,        "fg [PID] - Continue a stopped or background job and wait for it", false, runFg},
+	{"bg",         0, 1,        "bg [PID] - Continue a stopped job in the background",          false, runBg},
+	{"run",        1, 3,        "run FILE [-j N] - Run the jobs of FILE, lines of job NAME [after NAME...]: COMMAND, each once the jobs it comes after succeed, N at once", false, runRun},
+};
+constexpr int NUM_BUILTINS = sizeof(BUILTINS) / sizeof(BUILTINS[0]);
+
+// Hash a command name with a given seed (FNV-1a)
+// Input: string_view s - the name, uint32_t seed - perturbs the hash
+// Output: uint32_t - the hash
+constexpr uint32_t builtinHash(string_view s, uint32_t seed) {
+	uint32_t h = 2166136261u ^ seed;
+	for (char c: s) {
+		h ^= (unsigned char)c;
+		h *= 16777619u;
+	}
+	return h;
+}
+
+// Test if a seed sends every built-in name to its own slot
+// Input: uint32_t seed - the seed
+// Output: bool - True: there are no collisions
+constexpr bool isPerfectSeed(uint32_t seed) {
+	bool used[BUILTIN_SLOTS] = {};
+	for (int i = 0; i < NUM_BUILTINS; i++) {
+		uint32_t slot = builtinHash(BUILTINS[i].name, seed) % BUILTIN_SLOTS;
+		if (used[slot]) return false;
+		used[slot] = true;
+	}
+	return true;
+}
+
+// Find the first seed that hashes the built-in names without collisions
+constexpr uint32_t findBuiltinSeed() {
+	uint32_t seed = 0;
+	while (!isPerfectSeed(seed))
+		seed++;
+	return seed;
+}
+
+constexpr uint32_t BUILTIN_SEED = findBuiltinSeed();
+
+/*
+ * Struct: Builtin_Slots - Perfect hash table from slot to built-in index
+ */
+struct Builtin_Slots {
+	int8_t index[BUILTIN_SLOTS];			// BUILTINS index hashed to each slot, or -1
+};
+
+// Fill the perfect hash table
+constexpr Builtin_Slots makeBuiltinSlots() {
+	Builtin_Slots slots = {};
+	for (int i = 0; i < BUILTIN_SLOTS; i++)
+		slots.index[i] = -1;
+	for (int i = 0; i < NUM_BUILTINS; i++)
+		slots.index[builtinHash(BUILTINS[i].name, BUILTIN_SEED) % BUILTIN_SLOTS] = i;
+	return slots;
+}
+
+constexpr Builtin_Slots BUILTIN_SLOT_TABLE = makeBuiltinSlots();
+
+// Look up a built-in command by name
+// Input: string_view name - the command name
+// Output: the command_syms value of the built-in, or -1 if there is none
+constexpr int findBuiltin(string_view name) {
+	int i = BUILTIN_SLOT_TABLE.index[builtinHash(name, BUILTIN_SEED) % BUILTIN_SLOTS];
+	return (i >= 0 && name == BUILTINS[i].name) ? i : -1;
+}
+
+static_assert(findBuiltin("dalekall") == dalekall_sym && findBuiltin("dalek") == dalek_sym,
+		"BUILTINS must be in command_syms order");
+
+// Kinds of tokens in a command line
+typedef enum { token_word = 0, token_pipe, token_redirect_in, token_redirect_out, token_redirect_append,
+		token_redirect_err, token_redirect_err_append,
+} token_kinds;
+
+// States of a job started by the shell
+typedef enum { job_running = 0, job_stopped, job_done } job_states;
+
+// States of a job in a graph given to run
+typedef enum { graph_pending = 0, graph_running, graph_done, graph_failed, graph_skipped } graph_states;
+
+// Results of feeding a key to the line editor
+typedef enum { edit_more = 0, edit_done, edit_eof } edit_results;
+
+// Status byte of a reply from mysh --daemon
+typedef enum { reply_ok = 0, reply_failed, reply_invalid, reply_refused } reply_codes;
+
+// Kinds of names offered by tab completion
+typedef enum { name_file = 1, name_dir = 2, name_any = 3 } name_kinds;
+
+/*
+ * Class: Output_Buffer - Buffer behind cout, written out in one write once it fills or
+ * the shell is about to wait, rather than once per line
+ */
+class Output_Buffer : public streambuf {
+	private:
+
+	vector<char> buffer = vector<char>(OUTPUT_BUFFER);
+	streambuf* original = NULL;				// cout's own buffer, put back on destruction
+	int fd;									// Descriptor written to
+
+	public:
+
+	// Constructor
+	// Input: int outFd - descriptor to write to
+	Output_Buffer(int outFd) : fd(outFd) {
+		setp(buffer.data(), buffer.data() + buffer.size());
+	}
+
+	// Destructor
+	~Output_Buffer() {
+		sync();
+		if (original != NULL && cout.rdbuf() == this)
+			cout.rdbuf(original);
+	}
+
+	// Send everything written to cout through this buffer
+	void install() {
+		original = cout.rdbuf(this);
+	}
+
+	protected:
+
+	// Write out the buffered text
+	// Output: int - 0 on success, -1 if a write failed
+	int sync() override {
+		bool written = writeAll(pbase(), pptr() - pbase());
+		setp(buffer.data(), buffer.data() + buffer.size());
+		return written ? 0 : -1;
+	}
+
+	// The buffer is full: write it out and keep the byte that did not fit
+	int overflow(int c) override {
+		if (sync() < 0) return traits_type::eof();
+		if (c != traits_type::eof()) {
+			*pptr() = c;
+			pbump(1);
+		}
+		return traits_type::not_eof(c);
+	}
+
+	// Add a run of bytes, writing text larger than the buffer straight out
+	streamsize xsputn(const char* s, streamsize n) override {
+		if (n > epptr() - pptr()) {
+			if (sync() < 0) return 0;
+			if (n >= (streamsize)buffer.size())
+				return writeAll(s, n) ? n : 0;
+		}
+		memcpy(pptr(), s, n);
+		pbump(n);
+		return n;
+	}
+
+	private:
+
+	// Write all of a run of bytes, retrying short writes
+	// Output: bool - True: everything was written
+	bool writeAll(const char* data, size_t left) {
+		while (left > 0) {
+			ssize_t n = write(fd, data, left);
+			if (n < 0 && errno == EINTR) continue;
+			if (n <= 0) return false;
+			data += n;
+			left -= n;
+		}
+		return true;
+	}
+};
+
+/*
+ * Struct: Trace_Record - One span of shell work, for the trace file
+ */
+struct Trace_Record {
+	const char* name;						// Name of the span, a string literal
+	long long startNs;						// CLOCK_MONOTONIC time the span began
+	long long durNs;						// Length of the span
+	const char* argName;					// Name of the argument, a string literal, or NULL
+	long long arg;							// Value of the argument
+};
+
+/*
+ * Class: Tracer - Record spans of shell work when MYSH_TRACE names a file, and write them
+ * there as Chrome trace JSON, viewable in Perfetto or chrome://tracing. Records go into a
+ * fixed buffer that is written out whenever it fills and at exit. The shell has one thread,
+ * so the buffer has a single writer and needs no locking
+ */
+class Tracer {
+	private:
+
+	vector<Trace_Record> records;			// Records not yet written, TRACE_BUFFER of them
+	size_t used = 0;						// Records in use
+	int fd = -1;							// The trace file
+	bool wroteEvent = false;				// True once an event is in the file
+	pid_t pid = 0;
+
+	public:
+
+	bool enabled = false;					// True: spans are recorded
+
+	// Get the current CLOCK_MONOTONIC time
+	// Output: long long - nanoseconds
+	static long long now() {
+		struct timespec ts;
+		clock_gettime(CLOCK_MONOTONIC, &ts);
+		return ts.tv_sec * 1000000000LL + ts.tv_nsec;
+	}
+
+	// Start tracing into a file
+	// Input: const char* path - the file, replaced if it exists
+	// Output: bool - True: the file was opened
+	bool open(const char* path) {
+		fd = ::open(path, O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC, 0644);
+		if (fd < 0) return false;
+
+		pid = getpid();
+		records.resize(TRACE_BUFFER);
+		enabled = true;
+		string header = "{\"traceEvents\":[\n{\"name\":\"process_name\",\"ph\":\"M\",\"pid\":"
+			+ to_string(pid) + ",\"args\":{\"name\":\"mysh\"}}";
+		wroteEvent = true;
+		writeAll(header);
+		return true;
+	}
+
+	// Add a finished span
+	// Input: const char* name - the span, long long startNs - when it began, long long endNs - when it ended,
+	//		  const char* argName - name of an argument or NULL, long long arg - its value
+	void record(const char* name, long long startNs, long long endNs, const char* argName, long long arg) {
+		if (used == records.size())
+			drain();
+		records[used++] = {name, startNs, endNs - startNs, argName, arg};
+	}
+
+	// Write the buffered records to the file as trace events
+	void drain() {
+		string out;
+		char event[256];
+		for (size_t i = 0; i < used; i++) {
+			const Trace_Record& r = records[i];
+			int n = snprintf(event, sizeof(event),
+				"%s{\"name\":\"%s\",\"cat\":\"mysh\",\"ph\":\"X\",\"ts\":%.3f,\"dur\":%.3f,\"pid\":%d,\"tid\":%d",
+				wroteEvent ? ",\n" : "", r.name, r.startNs / 1e3, r.durNs / 1e3, (int)pid, (int)pid);
+			out.append(event, min(n, (int)sizeof(event) - 1));
+			if (r.argName != NULL)
+				out += ",\"args\":{\"" + string(r.argName) + "\":" + to_string(r.arg) + "}";
+			out += "}";
+			wroteEvent = true;
+		}
+		used = 0;
+		writeAll(out);
+	}
+
+	// Write what is left and finish the file
+	void close() {
+		if (!enabled) return;
+		drain();
+		writeAll("\n]}\n");
+		::close(fd);
+		fd = -1;
+		enabled = false;
+	}
+
+	private:
+
+	// Write a string to the trace file, stopping tracing if the write fails
+	void writeAll(const string& out) {
+		const char* data = out.data();
+		size_t left = out.size();
+		while (left > 0) {
+			ssize_t n = write(fd, data, left);
+			if (n < 0 && errno == EINTR) continue;
+			if (n <= 0) {
+				enabled = false;
+				return;
+			}
+			data += n;
+			left -= n;
+		}
+	}
+};
+
+extern Tracer tracer;
+
+/*
+ * Class: Trace_Span - Time a scope of shell work, recorded when it ends. With tracing off
+ * a span only tests one flag
+ */
+class Trace_Span {
+	private:
+
+	const char* name;
+	long long startNs = 0;
+	const char* argName = NULL;
+	long long arg = 0;
+	bool running;							// True: tracing was on when the span began, and it has not ended
+
+	public:
+
+	// Constructor
+	// Input: const char* spanName - the name of the span, a string literal
+	Trace_Span(const char* spanName) : name(spanName), running(tracer.enabled) {
+		if (running) startNs = Tracer::now();
+	}
+
+	// Destructor
+	~Trace_Span() {
+		end();
+	}
+
+	Trace_Span(const Trace_Span&) = delete;
+
+	// Attach a number to the span, such as a pid
+	// Input: const char* key - name of the number, a string literal, long long value - the number
+	void setArg(const char* key, long long value) {
+		argName = key;
+		arg = value;
+	}
+
+	// End the span before the scope does
+	void end() {
+		if (!running) return;
+		running = false;
+		if (tracer.enabled)
+			tracer.record(name, startNs, Tracer::now(), argName, arg);
+	}
+};
+
+/*
+ * Struct: Token_List - View of a run of tokens owned by a Command
+ */
+struct Token_List {
+	string_view* data = NULL;
+	int count = 0;
+
+	string_view operator[](int i) const { return data[i]; }
+	int size() const { return count; }
+	bool empty() const { return count == 0; }
+	string_view* begin() const { return data; }
+	string_view* end() const { return data + count; }
+};
+
+/*
+ * Class: Command - Keep track of information for a given input command
+ */
+class Command {
+	public:
+
+	string cmdInput;						// Input string from user
+	string_view command;					// command part of input
+	Token_List tokenized;					// every token of the input
+	Token_List args;						// the tokens after the command
+	char** argv = NULL;						// null terminated tokens for exec, argv[i] is tokenized[i]
+	int numTokens, commandNum;
+
+	private:
+
+	// One allocation holds, in order: the argv pointers, the token views, the token
+	// kinds and the token characters, each token followed by a null character
+	unique_ptr<char[]> block;
+	unsigned char* kinds = NULL;			// token_kinds value of each token
+
+	public:
+
+	// Constructor
+	// Input: String input - string read from input
+	Command(string input) {
+		cmdInput = std::move(input);
+		tokenize();
+		command = (numTokens > 0) ? tokenized[0] : "";
+		getCommandNum();
+		args.data = tokenized.data + 1;
+		args.count = max(numTokens - 1, 0);
+	}
+
+	// Commands are passed by reference and moved, never copied, so a command costs
+	// one allocation for its token block. Copying would tokenize again, so it is
+	// left out to make any copy that creeps into the dispatch path a compile error
+	Command(const Command& other) = delete;
+	Command& operator=(const Command& other) = delete;
+
+	// Move Constructor
+	// The block moves with its pointer, so the tokens stay valid
+	Command(Command&& other) = default;
+
+	// Move Assignment
+	Command& operator=(Command&& other) = default;
+
+	void printHistory(vector<Command>);
+
+	// Tokenize the input string in one pass
+	// Tokens are separated by spaces or tabs. An unquoted |, <, >, >>, 2> or 2>> is a
+	// token of its own, and a redirection may be followed directly by {hints}.
+	// Single quotes keep everything up to the closing quote, double quotes keep
+	// everything but allow \" and \\ inside, and a backslash outside quotes keeps
+	// the next character as is
+	void tokenize() {
+		size_t len = cmdInput.length();
+
+		// Every token takes at least one character of input, and the tokens
+		// hold at most len characters plus a null each
+		size_t maxTokens = len + 1;
+		size_t pointerBytes = (maxTokens + 1) * sizeof(char*);
+		size_t viewBytes = maxTokens * sizeof(string_view);
+		block.reset(new char[pointerBytes + viewBytes + maxTokens + len + maxTokens]);
+
+		argv = (char**)block.get();
+		tokenized.data = (string_view*)(block.get() + pointerBytes);
+		kinds = (unsigned char*)(block.get() + pointerBytes + viewBytes);
+		char* out = (char*)kinds + maxTokens;
+
+		const char* in = cmdInput.data();
+		const char* end = in + len;
+		numTokens = 0;
+
+		while (in < end) {
+			if (*in == ' ' || *in == '\t') {
+				in++;
+				continue;
+			}
+
+			char* start = out;
+			int kind = operatorAt(in, end);
+			kinds[numTokens] = kind;
+
+			if (kind == token_pipe)
+				*out++ = *in++;
+			else if (kind != token_word) {
+				// Copy the operator and its hints
+				int opLen = (kind == token_redirect_err_append) ? 3
+					: (kind == token_redirect_append || kind == token_redirect_err) ? 2 : 1;
+				while (opLen-- > 0)
+					*out++ = *in++;
+				if (in < end && *in == '{') {
+					while (in < end && *in != '}')
+						*out++ = *in++;
+					if (in < end)
+						*out++ = *in++;
+				}
+			}
+
+			char quote = 0;
+			while (kind == token_word && in < end) {
+				char c = *in;
+				if (quote == 0 && (c == ' ' || c == '\t' || c == '|' || c == '<' || c == '>'))
+					break;
+				in++;
+
+				if (quote == '\'') {
+					if (c == '\'') quote = 0;
+					else *out++ = c;
+				}
+				else if (quote == '"') {
+					if (c == '"') quote = 0;
+					else if (c == '\\' && in < end && (*in == '"' || *in == '\\')) *out++ = *in++;
+					else *out++ = c;
+				}
+				else if (c == '\'' || c == '"')
+					quote = c;
+				else if (c == '\\' && in < end)
+					*out++ = *in++;
+				else
+					*out++ = c;
+			}
+
+			tokenized.data[numTokens] = string_view(start, out - start);
+			argv[numTokens] = start;
+			*out++ = '\0';
+			numTokens++;
+		}
+
+		tokenized.count = numTokens;
+		argv[numTokens] = NULL;
+	}
+
+	// Get the kind of operator starting at a position of the input
+	// Input: const char* in - start of the token, const char* end - end of the input
+	// Output: the token_kinds value, token_word if there is no operator
+	static int operatorAt(const char* in, const char* end) {
+		bool err = (*in == '2' && in + 1 < end && in[1] == '>');
+		if (err) in++;
+
+		if (*in == '|') return token_pipe;
+		if (*in == '<') return token_redirect_in;
+		if (*in != '>') return token_word;
+
+		bool append = (in + 1 < end && in[1] == '>');
+		if (err) return append ? token_redirect_err_append : token_redirect_err;
+		return append ? token_redirect_append : token_redirect_out;
+	}
+
+	// Get the kind of a token
+	// Input: int i - index into tokenized
+	// Output: the token_kinds value of the token
+	int kind(int i) const {
+		return kinds[i];
+	}
+
+	// Get the null terminated arguments after the command
+	// Output: char** - the argument array, program first, for exec
+	char** execArgs() const {
+		return argv + 1;
+	}
+
+	// Rebuild the command line from a given token on, quoting words that
+	// would otherwise tokenize differently
+	// Input: int first - index into tokenized of the first token to keep
+	// Output: string - a command line that tokenizes to the same tokens
+	string joinFrom(int first) const {
+		string line;
+		for (int i = first; i < numTokens; i++) {
+			string_view token = tokenized[i];
+			if (i > first) line += ' ';
+
+			if (kinds[i] != token_word)
+				line += token;
+			else
+				appendWord(line, token);
+		}
+		return line;
+	}
+
+	// Append a word to a command line, quoted if it would not read back as one word
+	// Input: string& line - the command line, string_view word - the word
+	static void appendWord(string& line, string_view word) {
+		if (!word.empty() && word.find_first_of(" \t|<>'\"\\") == string_view::npos) {
+			line += word;
+			return;
+		}
+
+		line += '"';
+		for (char c: word) {
+			if (c == '"' || c == '\\') line += '\\';
+			line += c;
+		}
+		line += '"';
+	}
+
+	// Combine the arguments into a single string
+	// Output: a string of arguments
+	string combineArgs () const {
+		string combinedArgs = "";
+		if (numTokens < 2)
+			return combinedArgs;
+
+		for (string_view arg: args) {
+			combinedArgs += arg;
+			combinedArgs += " ";
+		}
+
+		return combinedArgs;
+	}
+
+	// Test if the command is a valid recognized command
+	// Output: bool - True: is valid
+	bool validCmd() const {
+		return (commandNum >= 0 && hasCorrectNumArgs());
+	}
+	
+	// Test if the command has arguments
+	// Output: bool - True: has arguments
+	bool hasArgs() const {
+		return !args.empty();
+	}
+	
+	// Test if the first argument is a given string
+	// Input: String arg - a string 
+	// Output: bool - True: is in arg
+	bool argsIs(string_view arg) const {
+		return args[0] == arg;
+	}
+
+	private:
+
+	// Get and Set the commandNum from the table of built-in commands
+	void getCommandNum() {
+		commandNum = findBuiltin(command);
+	}
+
+	// Check if the command has the correct number of arguments
+	// Return: bool - True: has correct number of arguments
+	bool hasCorrectNumArgs() const {
+		const Builtin& b = BUILTINS[commandNum];
+		int numArgs = args.size();
+		return numArgs >= b.minArgs && (b.maxArgs == ARGS_ANY || numArgs <= b.maxArgs);
+	}
+};
+
+/*
+ * Struct: History_Entry - Location of one command line in the history arena
+ */
+struct History_Entry {
+	size_t offset;							// Start of the command line in the arena
+	size_t length;							// Length of the command line
+};
+
+/*
+ * Class: Command_Stack - Keep track of the history of valid commands entered in the shell
+ */
+class Command_Stack {
+	private:
+
+	vector<History_Entry> historyStack;		// Ring buffer of entries, oldest is overwritten first
+	const char* mapped = NULL;				// History file mapped at startup, holds the loaded entries
+	size_t mappedSize = 0;					// Length of the mapping, offsets past it are in arena
+	string arena;							// Command lines of every entry pushed since, back to back
+	size_t liveBytes = 0;					// Bytes of arena used by entries still in the ring
+	int capacity;							// Maximum number of commands kept
+	int head = 0;							// Slot the next command is written to
+	int count = 0;							// Number of commands currently kept
+	string filename = "mysh_history.txt";
+	int journalFd = -1;						// History file, opened for appending
+	string journalBuffer;					// Lines not yet written to the history file
+	int journalLines = 0;					// Commands in the history file, including overwritten ones
+	long long stored = 0;					// Commands ever added to the ring, the number of the next one
+	long long listed = -1;					// Value of stored when history was last printed, -1 if never
+
+	// Get the entry a given number of entries back from the most recent
+	// Input: int n - 0 is the most recent command
+	// Output: the History_Entry
+	History_Entry& at(int n) {
+		return historyStack[(head - 1 - n + capacity) % capacity];
+	}
+
+	// Copy the entries still in the ring to a new arena, oldest first,
+	// once overwritten entries take up more than half of the storage
+	void compact() {
+		size_t used = mappedSize + arena.size();
+		if (used < ARENA_MIN_COMPACT || used < 2 * liveBytes) return;
+
+		string packed;
+		packed.reserve(liveBytes * 2);
+		for (int i = count - 1; i >= 0; i--) {
+			string_view line = entry(i);
+			at(i).offset = packed.size();
+			packed.append(line);
+		}
+		arena.swap(packed);
+		unmap();
+	}
+
+	// Release the mapping of the history file
+	void unmap() {
+		if (mapped != NULL)
+			munmap((void*)mapped, mappedSize);
+		mapped = NULL;
+		mappedSize = 0;
+	}
+
+	public:
+
+	// Keep the history file in the given directory rather than wherever the shell has moved to
+	// Input: const string& dir - the directory, ending in "/"
+	void setDirectory(const string& dir) {
+		filename = dir + "mysh_history.txt";
+	}
+
+	// Constructor
+	// The number of commands kept comes from the HISTSIZE environment variable, if set
+	Command_Stack() {
+		capacity = HISTSIZE;
+
+		const char* histsize = getenv("HISTSIZE");
+		if (histsize != NULL && atoi(histsize) > 0)
+			capacity = atoi(histsize);
+
+		historyStack.reserve(capacity);
+	}
+
+	// Destructor
+	~Command_Stack() {
+		historyStack.clear();
+		unmap();
+		if (journalFd >= 0)
+			close(journalFd);
+	}
+
+	// Get the command line a given number of entries back from the most recent
+	// Input: int n - 0 is the most recent command
+	// Output: a view of the command line, valid until the next push
+	string_view entry(int n) {
+		History_Entry& e = at(n);
+		if (e.offset < mappedSize)
+			return string_view(mapped + e.offset, e.length);
+		return string_view(arena.data() + e.offset - mappedSize, e.length);
+	}
+
+	// Print the current history stack to the console, most recent command first
+	// replay N runs the command printed as N until history is printed again
+	void printHistory() {
+		listed = stored;
+		if (count == 0) return;
+		cout << OUT_INDENT << "History:" << '\n';
+		for (int i = 0; i < count; i++)
+			cout << OUT_INDENT << i << ": " << entry(i) << '\n';
+	}
+	
+	// Get the command a replay command refers to, parsing it from its command line
+	// Input: const Command& cmd - a replay Command
+	// Output: the Command found, or Command("0") if not
+	Command findReplayNum(const Command& cmd) {
+		int replayArg = -1;
+		string_view arg = cmd.args[0];
+		from_chars(arg.data(), arg.data() + arg.size(), replayArg);
+
+		// Commands pushed since the listing, the history command among them, shift the entries back
+		if (replayArg >= 0 && listed >= 0)
+			replayArg += stored - listed;
+		if (replayArg < 0 || replayArg >= count)
+			return Command("0");
+
+		Command found(string(entry(replayArg)));
+		if (found.commandNum == replay_sym) {
+			cout << OUT_INDENT << "Invalid Command: " << cmd.command << " " << found.cmdInput << '\n';
+			return Command("0");
+		}
+
+		return found;
+	}
+
+	// Read the history stack from a file
+	// The file has a header line, then one command per line, oldest first.
+	// It is mapped into memory and the newest commands that fit in the ring are
+	// indexed in place; they are not copied or parsed until printed or replayed.
+	// Files without the header are from older versions, which wrote all commands
+	// on one line separated by commas, most recent first; those are converted
+	void readFromFile() {
+		Trace_Span span("history_load");
+		int fd = ::open(filename.c_str(), O_RDONLY | O_CLOEXEC);
+		if (fd < 0) return; // no file yet
+
+		struct stat st;
+		if (fstat(fd, &st) < 0 || st.st_size == 0) {
+			close(fd);
+			return;
+		}
+
+		size_t size = st.st_size;
+		void* map = mmap(NULL, size, PROT_READ, MAP_PRIVATE, fd, 0);
+		close(fd);
+		if (map == MAP_FAILED) return;
+
+		const char* data = (const char*)map;
+		size_t headerLen = strlen(HISTORY_HEADER);
+		if (size > headerLen && memcmp(data, HISTORY_HEADER, headerLen) == 0 && data[headerLen] == '\n') {
+			// Keep the mapping, the loaded entries point into it
+			mapped = data;
+			mappedSize = size;
+			loadJournal(headerLen + 1);
+			return;
+		}
+
+		loadLegacy(string(data, size));
+		munmap(map, size);
+	}
+
+	// Index the commands of the mapped journal in the ring
+	// Input: size_t first - offset of the first line after the header
+	void loadJournal(size_t first) {
+		const char* data = mapped + first;
+		const char* end = mapped + mappedSize;
+
+		// Step back over at most capacity lines from the end
+		const char* start = end;
+		int kept = 0;
+		if (start > data && start[-1] == '\n') start--;
+		while (start > data && kept < capacity) {
+			const char* nl = (const char*)memrchr(data, '\n', start - data);
+			start = (nl == NULL) ? data : nl;
+			kept++;
+		}
+		// Older lines are not counted, but there are enough that the next push compacts
+		if (start > data) {
+			start++; // skip the newline before the first kept line
+			journalLines = capacity;
+		}
+
+		// Index the kept lines where they are in the mapping
+		const char* p = start;
+		while (p < end) {
+			const char* nl = (const char*)memchr(p, '\n', end - p);
+			if (nl == NULL) nl = end;
+
+			if (nl > p) {
+				History_Entry e = {(size_t)(p - mapped), (size_t)(nl - p)};
+				if ((int)historyStack.size() < capacity)
+					historyStack.push_back(e);
+				else
+					historyStack[head] = e;
+				head = (head + 1) % capacity;
+				count = min(count + 1, capacity);
+				liveBytes += e.length;
+				stored++;
+			}
+			journalLines++;
+			p = nl + 1;
+		}
+	}
+
+	// Load history written by older versions and convert the file
+	// Input: string contents - the whole file
+	void loadLegacy(string contents) {
+		stringstream fin(contents);
+		string line, cmd;
+		list<string> cmdsIn;
+
+		while (getline(fin, line)) {
+			stringstream stream(line);
+
+			while (getline(stream, cmd, ',')) {
+				cmdsIn.push_back(cmd);
+			}
+		}
+
+		// Push the oldest kept first
+		list<string>::reverse_iterator it;
+		int skip = max((int)cmdsIn.size() - capacity, 0);
+		for (it = cmdsIn.rbegin(); it != cmdsIn.rend(); it++) {
+			if (skip-- > 0) continue;
+			store(*it);
+		}
+
+		rewriteFile();
+	}
+
+	// Write any commands not yet in the history file
+	void flushToFile() {
+		if (journalBuffer.empty()) return;
+
+		if (journalFd < 0) {
+			journalFd = ::open(filename.c_str(), O_WRONLY | O_APPEND | O_CREAT | O_CLOEXEC, 0644);
+			if (journalFd < 0) return;
+
+			struct stat st;
+			if (fstat(journalFd, &st) == 0 && st.st_size == 0)
+				journalBuffer.insert(0, HISTORY_HEADER "\n");
+		}
+
+		const char* data = journalBuffer.data();
+		size_t left = journalBuffer.size();
+		while (left > 0) {
+			ssize_t n = write(journalFd, data, left);
+			if (n < 0) {
+				if (errno == EINTR) continue;
+				break;
+			}
+			data += n;
+			left -= n;
+		}
+		journalBuffer.clear();
+	}
+
+	// Replace the history file with only the commands currently kept
+	// Written to a temporary file first so a crash leaves the old file intact
+	void rewriteFile() {
+		Trace_Span span("history_rewrite");
+		string tmpName = filename + ".tmp";
+		ofstream fout(tmpName);
+		if (!fout.is_open()) return;
+
+		fout << HISTORY_HEADER << '\n';
+		for (int i = count - 1; i >= 0; i--)
+			fout << entry(i) << '\n';
+		fout.close();
+
+		if (fout.fail() || rename(tmpName.c_str(), filename.c_str()) < 0) {
+			remove(tmpName.c_str());
+			return;
+		}
+
+		if (journalFd >= 0) {
+			close(journalFd);
+			journalFd = -1;
+		}
+		journalLines = count;
+	}
+
+	// Get the size of the history stack
+	int size() {
+		return count;
+	}
+
+	// Get the sequence number the next command added will have. Numbers are never
+	// reused, entry(n) has number nextSeq() - 1 - n while it is kept
+	long long nextSeq() {
+		return stored;
+	}
+
+	// Clear current history stack and delete history file
+	void clearHistory() {
+		historyStack.clear();
+		unmap();
+		arena.clear();
+		liveBytes = 0;
+		head = 0;
+		count = 0;
+		listed = -1;
+
+		if (journalFd >= 0) {
+			close(journalFd);
+			journalFd = -1;
+		}
+		journalBuffer.clear();
+		journalLines = 0;
+		remove(filename.c_str());
+		cout << OUT_INDENT << "History Cleared" << '\n';
+	}
+
+	// Push a command line onto the history stack and append it to the history file
+	// The file is compacted once it holds twice as many commands as are kept
+	// Input: const string& cmdInput - the command line
+	void push(const string& cmdInput) {
+		Trace_Span span("history_push");
+		store(cmdInput);
+
+		journalBuffer += cmdInput;
+		journalBuffer += '\n';
+		journalLines++;
+		flushToFile();
+
+		if (journalLines > 2 * capacity)
+			rewriteFile();
+	}
+
+	// Add a command line to the ring, replacing the oldest one if full
+	// Input: const string& cmdInput - the command line
+	void store(const string& cmdInput) {
+		History_Entry e = {mappedSize + arena.size(), cmdInput.size()};
+		arena += cmdInput;
+		liveBytes += e.length;
+
+		if ((int)historyStack.size() < capacity)
+			historyStack.push_back(e);
+		else {
+			if (count == capacity)
+				liveBytes -= historyStack[head].length;
+			historyStack[head] = e;
+		}
+
+		head = (head + 1) % capacity;
+		if (count < capacity)
+			count++;
+		stored++;
+
+		compact();
+	}
+
+	// Remove and return the oldest Command in the history stack
+	// Output: a Command
+	Command pop() {
+		Command c(string(entry(count - 1)));
+		liveBytes -= at(count - 1).length;
+		count--;
+		return c;
+	}
+};
+
+/*
+ * Class: Spawn_Actions - File actions and attributes applied to a child started by posix_spawn
+ */
+class Spawn_Actions {
+	public:
+
+	posix_spawn_file_actions_t actions;		// Opens, dups and closes done in the child before exec
+	posix_spawnattr_t attr;					// Signal mask, process group and scheduling attributes
+
+	// Constructor
+	Spawn_Actions() {
+		sigset_t empty, jobSignals;
+		sigemptyset(&empty);
+		sigemptyset(&jobSignals);
+		sigaddset(&jobSignals, SIGTSTP);
+		sigaddset(&jobSignals, SIGTTIN);
+		sigaddset(&jobSignals, SIGTTOU);
+
+		posix_spawn_file_actions_init(&actions);
+		posix_spawnattr_init(&attr);
+
+		// The shell blocks SIGCHLD for its signalfd and ignores the job control
+		// signals, children must not inherit either
+		posix_spawnattr_setsigmask(&attr, &empty);
+		posix_spawnattr_setsigdefault(&attr, &jobSignals);
+		posix_spawnattr_setflags(&attr, POSIX_SPAWN_SETSIGMASK | POSIX_SPAWN_SETSIGDEF);
+	}
+
+	// Destructor
+	~Spawn_Actions() {
+		posix_spawn_file_actions_destroy(&actions);
+		posix_spawnattr_destroy(&attr);
+	}
+
+	// Put the child in a process group, so signals typed at the terminal do not reach it
+	// Input: pid_t pgid - group to join, 0 to start a new group led by the child
+	void setProcessGroup(pid_t pgid) {
+		short flags;
+		posix_spawnattr_getflags(&attr, &flags);
+		posix_spawnattr_setpgroup(&attr, pgid);
+		posix_spawnattr_setflags(&attr, flags | POSIX_SPAWN_SETPGROUP);
+	}
+
+	// Open a file onto a descriptor in the child
+	// Input: int fd - descriptor in the child, const char* path - file to open,
+	//		  int flags - open flags, mode_t mode - creation mode
+	// Output: bool - True: action was added
+	bool open(int fd, const char* path, int flags, mode_t mode) {
+		return posix_spawn_file_actions_addopen(&actions, fd, path, flags, mode) == 0;
+	}
+
+	// Duplicate a descriptor onto another in the child
+	// Input: int fd - descriptor to copy, int newfd - descriptor to replace
+	// Output: bool - True: action was added
+	bool dup2(int fd, int newfd) {
+		return posix_spawn_file_actions_adddup2(&actions, fd, newfd) == 0;
+	}
+
+	// Close a descriptor in the child
+	// Input: int fd - descriptor to close
+	// Output: bool - True: action was added
+	bool close(int fd) {
+		return posix_spawn_file_actions_addclose(&actions, fd) == 0;
+	}
+};
+
+/*
+ * Class: Spawn_Scheduler - Keep track of a bounded set of running children through pidfds
+ */
+class Spawn_Scheduler {
+	private:
+
+	vector<struct pollfd> running;			// pidfd of each running child
+	vector<pid_t> pids;						// pid of each running child, same order as running
+	int limit;								// Maximum number of children running at once
+
+	public:
+
+	// Constructor
+	// Input: int maxRunning - maximum number of children running at once
+	Spawn_Scheduler(int maxRunning) {
+		limit = maxRunning;
+	}
+
+	// Destructor
+	~Spawn_Scheduler() {
+		for (struct pollfd p: running)
+			::close(p.fd);
+	}
+
+	// Test if another child can be started
+	// Output: bool - True: a slot is open
+	bool hasSlot() {
+		return (int)running.size() < limit;
+	}
+
+	// Get the number of children being tracked
+	int size() {
+		return running.size();
+	}
+
+	// Track a newly started child
+	// Input: pid_t pid - pid of the child
+	// Output: bool - True: child is tracked, False: no pidfd could be opened for it
+	bool add(pid_t pid) {
+		int fd = syscall(SYS_pidfd_open, pid, 0);
+		if (fd < 0) return false;
+
+		running.push_back({fd, POLLIN, 0});
+		pids.push_back(pid);
+		return true;
+	}
+
+	// Block until at least one tracked child exits. The exited children are
+	// left for the reaper to collect
+	// Output: the pids of every child that exited
+	vector<pid_t> waitForSlot() {
+		vector<pid_t> finished;
+		if (running.empty()) return finished;
+
+		cout.flush(); // the PID lines of the children started so far are shown before blocking
+		while (poll(running.data(), running.size(), -1) < 0) {
+			if (errno != EINTR)
+				return finished;
+		}
+
+		// Remove each exited child by swapping it with the last slot
+		for (int i = running.size() - 1; i >= 0; i--) {
+			if (running[i].revents == 0) continue;
+
+			::close(running[i].fd);
+			finished.push_back(pids[i]);
+
+			running[i] = running.back();
+			running.pop_back();
+			pids[i] = pids.back();
+			pids.pop_back();
+		}
+
+		return finished;
+	}
+};
+
+/*
+ * Class: Arg_Template - The arguments of repeat, with {i} and {n} filled in for each process.
+ * Arguments are split around {i} once, so starting a process only writes its index
+ * into the gaps, and arguments without {i} are shared by every process
+ */
+class Arg_Template {
+	private:
+
+	struct Templated {
+		int arg;							// Index into argv of the argument
+		vector<string> pieces;				// Text around each {i}, one more than the number of {i}
+		string filled;						// The text for the current index
+	};
+
+	vector<char*> argv;						// Arguments of the current process, null terminated
+	vector<Templated> templated;			// Arguments holding {i} or {n}
+	Templated lineTemplate;					// The command line recorded in the job table
+
+	// Split text around {i}, replacing {n}
+	// Input: string_view text - the text, const string& count - the value of {n}, vector<string>* pieces - set to the text around each {i}
+	static void split(string_view text, const string& count, vector<string>* pieces) {
+		pieces->assign(1, "");
+		for (size_t pos = 0; pos < text.size(); ) {
+			if (text.compare(pos, 3, "{i}") == 0) {
+				pieces->push_back("");
+				pos += 3;
+			}
+			else if (text.compare(pos, 3, "{n}") == 0) {
+				pieces->back() += count;
+				pos += 3;
+			}
+			else
+				pieces->back() += text[pos++];
+		}
+	}
+
+	// Join the pieces of a template around an index
+	static void fillOne(Templated& t, string_view index) {
+		t.filled.clear();
+		for (size_t k = 0; k < t.pieces.size(); k++) {
+			if (k > 0) t.filled.append(index.data(), index.size());
+			t.filled += t.pieces[k];
+		}
+	}
+
+	public:
+
+	// Constructor
+	// Input: char** args - the program and arguments, null terminated, int count - the value of {n}
+	Arg_Template(char** args, int count) {
+		string n = to_string(count);
+		for (int a = 0; args[a] != NULL; a++) {
+			argv.push_back(args[a]);
+			string_view arg = args[a];
+			if (arg.find("{i}") == string_view::npos && arg.find("{n}") == string_view::npos)
+				continue;
+
+			templated.push_back({a, {}, ""});
+			split(arg, n, &templated.back().pieces);
+		}
+		argv.push_back(NULL);
+		split(joinArgs(args), n, &lineTemplate.pieces);
+
+		// Arguments with only {n} are the same for every process, so fill them now
+		for (Templated& t: templated) {
+			if (t.pieces.size() > 1) continue;
+			t.filled = t.pieces[0];
+			argv[t.arg] = t.filled.data();
+		}
+	}
+
+	Arg_Template(const Arg_Template&) = delete;	// argv points into templated
+
+	// Fill in the arguments for one process
+	// Input: int i - index of the process, the value of {i}
+	// Output: char** - the arguments, valid until the next fill
+	char** fill(int i) {
+		char digits[16];
+		string_view index(digits, to_chars(digits, digits + sizeof(digits), i).ptr - digits);
+
+		for (Templated& t: templated) {
+			if (t.pieces.size() == 1) continue;
+			fillOne(t, index);
+			argv[t.arg] = t.filled.data();
+		}
+		fillOne(lineTemplate, index);
+		return argv.data();
+	}
+
+	// Get the command line of the process last filled in
+	const string& line() const {
+		return lineTemplate.filled;
+	}
+};
+
+/*
+ * Struct: Child_Exit - Exit status and resource usage of a reaped child
+ */
+struct Child_Exit {
+	pid_t pid;
+	int status;								// Status as returned by wait4
+	struct rusage usage;					// Resources used by the child
+};
+
+/*
+ * Struct: Job - A process started by the shell
+ */
+struct Job {
+	pid_t pid;
+	pid_t pgid;								// Process group, shared by every stage of a pipeline
+	string cmdLine;							// Program and arguments the process was started with
+	struct timespec started;				// CLOCK_MONOTONIC time the process was started
+	struct timespec ended;					// CLOCK_MONOTONIC time the process was reaped
+	int state;								// job_states value
+	bool foreground;						// True: started by start, False: by background
+	int status;								// Status as returned by wait4, once done
+	struct rusage usage;					// Resources used, once done
+	vector<int> cacheFds;					// Redirected files to drop from the page cache when done
+};
+
+/*
+ * Class: Job_Table - The running jobs in dense storage, indexed by pid
+ */
+class Job_Table {
+	private:
+
+	vector<Job> jobs;						// Running jobs, in no particular order
+	unordered_map<pid_t, size_t> index;		// pid -> position in jobs
+
+	public:
+
+	// Add a newly started job
+	// Input: pid_t pid - pid of the process, const string& cmdLine - what it is running,
+	//		  bool foreground - True: the shell waits for it
+	// Output: the new Job
+	Job* add(pid_t pid, const string& cmdLine, bool foreground) {
+		Job job;
+		job.pid = pid;
+		job.pgid = pid;
+		job.cmdLine = cmdLine;
+		clock_gettime(CLOCK_MONOTONIC, &job.started);
+		job.ended = job.started;
+		job.state = job_running;
+		job.foreground = foreground;
+		job.status = 0;
+		memset(&job.usage, 0, sizeof(job.usage));
+
+		index[pid] = jobs.size();
+		jobs.push_back(job);
+		return &jobs.back();
+	}
+
+	// Find a running job
+	// Input: pid_t pid - pid of the process
+	// Output: the Job, or NULL if pid is not running
+	Job* find(pid_t pid) {
+		unordered_map<pid_t, size_t>::iterator it = index.find(pid);
+		if (it == index.end()) return NULL;
+		return &jobs[it->second];
+	}
+
+	// Remove a job by moving the last job into its slot
+	// Input: pid_t pid - pid of the process, Job* removed - set to the removed job, or NULL
+	// Output: bool - True: the job was found and removed
+	bool remove(pid_t pid, Job* removed) {
+		unordered_map<pid_t, size_t>::iterator it = index.find(pid);
+		if (it == index.end()) return false;
+
+		size_t idx = it->second;
+		index.erase(it);
+		if (removed != NULL)
+			*removed = std::move(jobs[idx]);
+
+		if (idx + 1 < jobs.size()) {
+			jobs[idx] = std::move(jobs.back());
+			index[jobs[idx].pid] = idx;
+		}
+		jobs.pop_back();
+		return true;
+	}
+
+	// Get the number of running jobs
+	int size() {
+		return jobs.size();
+	}
+
+	// Iterate over the running jobs
+	vector<Job>::iterator begin() { return jobs.begin(); }
+	vector<Job>::iterator end() { return jobs.end(); }
+};
+
+/*
+ * Class: Child_Reaper - Collect exited children through a signalfd for SIGCHLD
+ */
+class Child_Reaper {
+	public:
+
+	int fd = -1;							// signalfd that becomes readable when a child changes state or on SIGINT
+	int interrupts = 0;						// Number of SIGINTs received
+	bool interruptTyped = false;			// True if the last SIGINT came from the terminal rather than from kill
+
+	// Destructor
+	~Child_Reaper() {
+		if (fd >= 0) close(fd);
+	}
+
+	// Block SIGCHLD and SIGINT and open the signalfd that receives them instead
+	// Output: bool - True: the signalfd is ready
+	bool open() {
+		sigset_t mask;
+		sigemptyset(&mask);
+		sigaddset(&mask, SIGCHLD);
+		sigaddset(&mask, SIGINT);
+		if (sigprocmask(SIG_BLOCK, &mask, NULL) < 0)
+			return false;
+
+		fd = signalfd(-1, &mask, SFD_NONBLOCK | SFD_CLOEXEC);
+		return fd >= 0;
+	}
+
+	// Drain pending SIGCHLD notifications and reap every exited child
+	// Children that stopped or continued are returned as well, without being reaped
+	// Output: the exit record of each reaped child
+	vector<Child_Exit> reap() {
+		vector<Child_Exit> exits;
+		struct signalfd_siginfo info;
+
+		// Signals coalesce, so the count read here says nothing about how many exited
+		while (fd >= 0 && read(fd, &info, sizeof(info)) == sizeof(info)) {
+			if (info.ssi_signo == SIGINT) {
+				interrupts++;
+				interruptTyped = info.ssi_code == SI_KERNEL;
+			}
+		}
+
+		Child_Exit ex;
+		while ((ex.pid = wait4(-1, &ex.status, WNOHANG | WUNTRACED | WCONTINUED, &ex.usage)) > 0)
+			exits.push_back(ex);
+
+		return exits;
+	}
+};
+
+/*
+ * Class: Input_Reader - Read lines from a descriptor through a buffer
+ */
+class Input_Reader {
+	private:
+
+	int fd;
+	string buffer;							// Bytes read but not yet returned as lines
+	size_t pos = 0;							// Start of the first unreturned line in buffer
+
+	public:
+
+	bool eof = false;						// True once the descriptor has no more input
+	bool pollable = true;					// False if the descriptor cannot be watched by epoll
+	bool interactive = true;				// False when reading a script: no prompts, larger reads
+
+	// Constructor
+	// Input: int inputFd - descriptor to read from
+	Input_Reader(int inputFd) {
+		fd = inputFd;
+	}
+
+	// Read from a different descriptor
+	// Input: int inputFd - descriptor to read from
+	void attach(int inputFd) {
+		fd = inputFd;
+	}
+
+	// Get the next complete line already in the buffer
+	// Input: string& line - set to the line, without its newline
+	// Output: bool - True: a line was returned
+	bool getLine(string& line) {
+		size_t nl = buffer.find('\n', pos);
+		if (nl == string::npos) {
+			// Return the unterminated last line once the input has ended
+			if (!eof || pos >= buffer.size()) return false;
+			nl = buffer.size();
+		}
+
+		line.assign(buffer, pos, nl - pos);
+		pos = nl + 1;
+		if (pos >= buffer.size()) {
+			buffer.clear();
+			pos = 0;
+		}
+		return true;
+	}
+
+	// Get the next byte already in the buffer
+	// Input: char* c - set to the byte
+	// Output: bool - True: a byte was returned
+	bool getChar(char* c) {
+		if (pos >= buffer.size()) return false;
+
+		*c = buffer[pos++];
+		if (pos >= buffer.size()) {
+			buffer.clear();
+			pos = 0;
+		}
+		return true;
+	}
+
+	// Read whatever input is available into the buffer
+	// Output: bool - False: the read failed for a reason other than an interrupt
+	bool fill() {
+		// Drop the lines already returned, keeping a partial last line
+		if (pos > 0) {
+			buffer.erase(0, pos);
+			pos = 0;
+		}
+
+		// Read straight into the buffer, a terminal line at a time or a script in large chunks
+		size_t len = buffer.size();
+		size_t chunk = interactive ? BUFFER_MAX : SCRIPT_CHUNK;
+		buffer.resize(len + chunk);
+		ssize_t n = read(fd, &buffer[len], chunk);
+		buffer.resize(len + (n > 0 ? n : 0));
+
+		if (n == 0)
+			eof = true;
+		else if (n < 0 && errno != EINTR && errno != EAGAIN)
+			return false;
+
+		return true;
+	}
+};
+
+/*
+ * Class: History_Index - Trigram index over the history, for incremental search
+ */
+class History_Index {
+	private:
+
+	unordered_map<uint32_t, vector<uint32_t>> postings;	// Trigram -> sequence numbers of the entries holding it, ascending
+	long long firstIndexed = 0;				// Lowest sequence number indexed
+	long long indexedTo = 0;				// Sequence numbers below this are indexed
+
+	// Pack three bytes into a key
+	static uint32_t trigram(const char* p) {
+		return (unsigned char)p[0] | (unsigned char)p[1] << 8 | (unsigned char)p[2] << 16;
+	}
+
+	// Index the entries added to the history since the last search
+	// Input: Command_Stack& history - the history
+	void update(Command_Stack& history) {
+		long long next = history.nextSeq();
+		long long oldest = next - history.size();
+
+		// Rebuild once evicted entries make up most of the postings
+		if (oldest > indexedTo || oldest - firstIndexed > next - oldest) {
+			postings.clear();
+			firstIndexed = indexedTo = oldest;
+		}
+
+		vector<uint32_t> grams;
+		for (; indexedTo < next; indexedTo++) {
+			string_view line = history.entry(next - 1 - indexedTo);
+			grams.clear();
+			for (size_t i = 0; i + 3 <= line.size(); i++)
+				grams.push_back(trigram(line.data() + i));
+			sort(grams.begin(), grams.end());
+			grams.erase(unique(grams.begin(), grams.end()), grams.end());
+
+			for (uint32_t g: grams)
+				postings[g].push_back(indexedTo);
+		}
+	}
+
+	public:
+
+	// Find the newest entry containing a string, older than a given one
+	// Input: Command_Stack& history - the history, string_view query - the string,
+	//		  long long before - only entries numbered below this are searched
+	// Output: long long - the sequence number of the entry, or -1 if none matches
+	long long search(Command_Stack& history, string_view query, long long before) {
+		if (query.empty()) return -1;
+		update(history);
+
+		long long next = history.nextSeq();
+		long long oldest = next - history.size();
+		before = min(before, next);
+
+		// Too short for a trigram, scan from the newest
+		if (query.size() < 3) {
+			for (long long seq = before - 1; seq >= oldest; seq--)
+				if (history.entry(next - 1 - seq).find(query) != string_view::npos)
+					return seq;
+			return -1;
+		}
+
+		// Candidates come from the rarest trigram of the query
+		const vector<uint32_t>* rarest = NULL;
+		for (size_t i = 0; i + 3 <= query.size(); i++) {
+			unordered_map<uint32_t, vector<uint32_t>>::iterator it = postings.find(trigram(query.data() + i));
+			if (it == postings.end()) return -1;
+			if (rarest == NULL || it->second.size() < rarest->size())
+				rarest = &it->second;
+		}
+
+		vector<uint32_t>::const_iterator it = lower_bound(rarest->begin(), rarest->end(), (uint32_t)before);
+		while (it != rarest->begin()) {
+			long long seq = *--it;
+			if (seq < oldest) break;
+			if (history.entry(next - 1 - seq).find(query) != string_view::npos)
+				return seq;
+		}
+		return -1;
+	}
+};
+
+/*
+ * Struct: Name_Match - A name found by completion
+ */
+struct Name_Match {
+	string name;
+	int kind;								// name_file or name_dir
+};
+
+/*
+ * Class: Prefix_Trie - Set of names searched by prefix, each marked a file or a directory
+ */
+class Prefix_Trie {
+	private:
+
+	struct Node {
+		uint32_t child = 0;					// First child, 0 for none
+		uint32_t next = 0;					// Next sibling, in byte order, 0 for none
+		uint32_t count[2] = {};				// Files and directories named at or below this node
+		char c = 0;							// Byte leading here from the parent
+		uint8_t kind = 0;					// name_file or name_dir if a name ends here, otherwise 0
+	};
+
+	vector<Node> nodes = vector<Node>(1);	// nodes[0] is the root
+
+	// Find the child of a node reached by a byte
+	// Input: uint32_t n - the node, char c - the byte, bool create - add the child if missing
+	// Output: uint32_t - the child, or 0 if it is missing and not created
+	uint32_t child(uint32_t n, char c, bool create) {
+		uint32_t* link = &nodes[n].child;
+		while (*link != 0 && (unsigned char)nodes[*link].c < (unsigned char)c)
+			link = &nodes[*link].next;
+		if (*link != 0 && nodes[*link].c == c) return *link;
+		if (!create) return 0;
+
+		Node added;
+		added.c = c;
+		added.next = *link;
+		uint32_t index = nodes.size();
+		*link = index;						// before push_back, which may move nodes
+		nodes.push_back(added);
+		return index;
+	}
+
+	// Find the node a prefix leads to
+	// Input: string_view prefix - the prefix
+	// Output: uint32_t - the node, or 0 if no name starts with the prefix
+	uint32_t find(string_view prefix) const {
+		uint32_t n = 0;
+		for (char c: prefix) {
+			n = nodes[n].child;
+			while (n != 0 && nodes[n].c != c)
+				n = nodes[n].next;
+			if (n == 0) return 0;
+		}
+		return n;
+	}
+
+	// Count the names of the wanted kinds at or below a node
+	int count(uint32_t n, int kinds) const {
+		return ((kinds & name_file) ? nodes[n].count[0] : 0) + ((kinds & name_dir) ? nodes[n].count[1] : 0);
+	}
+
+	// Add or remove one name along the path to it
+	void adjust(string_view name, int kind, int delta) {
+		int slot = (kind == name_dir) ? 1 : 0;
+		uint32_t n = 0;
+		nodes[0].count[slot] += delta;
+		for (char c: name) {
+			n = child(n, c, false);
+			nodes[n].count[slot] += delta;
+		}
+	}
+
+	// Collect names below a node in byte order
+	void collect(uint32_t n, string& name, int kinds, bool hideDots, size_t limit, vector<Name_Match>* out) const {
+		if (nodes[n].kind & kinds)
+			out->push_back({name, nodes[n].kind});
+		for (uint32_t c = nodes[n].child; c != 0 && out->size() < limit; c = nodes[c].next) {
+			if (count(c, kinds) == 0 || (hideDots && nodes[c].c == '.')) continue;
+			name += nodes[c].c;
+			collect(c, name, kinds, false, limit, out);
+			name.pop_back();
+		}
+	}
+
+	public:
+
+	// Remove every name
+	void clear() {
+		nodes.assign(1, Node());
+	}
+
+	// Number of names held
+	int size() const {
+		return count(0, name_any);
+	}
+
+	// Add a name, or change its kind
+	// Input: string_view name - the name, int kind - name_file or name_dir
+	void insert(string_view name, int kind) {
+		if (name.empty()) return;
+		uint32_t n = 0;
+		for (char c: name)
+			n = child(n, c, true);
+		if (nodes[n].kind == kind) return;
+		if (nodes[n].kind != 0) adjust(name, nodes[n].kind, -1);
+		nodes[n].kind = kind;
+		adjust(name, kind, 1);
+	}
+
+	// Remove a name, if held
+	// Input: string_view name - the name
+	void erase(string_view name) {
+		uint32_t n = find(name);
+		if (name.empty() || n == 0 || nodes[n].kind == 0) return;
+		adjust(name, nodes[n].kind, -1);
+		nodes[n].kind = 0;
+	}
+
+	// Find the names starting with a prefix, and what all of them share after it
+	// Input: string_view prefix - the prefix, int kinds - name_file, name_dir or both,
+	//		  bool hideDots - skip names starting with . when prefix is empty,
+	//		  size_t limit - most names to collect, string* common - set to the shared text after the prefix,
+	//		  vector<Name_Match>* out - the names collected, in byte order
+	// Output: int - the number of matching names
+	int complete(string_view prefix, int kinds, bool hideDots, size_t limit, string* common, vector<Name_Match>* out) const {
+		common->clear();
+		uint32_t n = find(prefix);
+		if (n == 0 && !prefix.empty()) return 0;
+		hideDots = hideDots && prefix.empty();
+
+		int total = count(n, kinds);
+		if (hideDots) {
+			uint32_t dot = find(".");
+			if (dot != 0) total -= count(dot, kinds);
+		}
+		if (total <= 0) return 0;
+
+		// Follow the only branch holding matches until names part ways or one ends
+		uint32_t shared = n;
+		while ((nodes[shared].kind & kinds) == 0) {
+			uint32_t only = 0;
+			int branches = 0;
+			for (uint32_t c = nodes[shared].child; c != 0; c = nodes[c].next) {
+				if (count(c, kinds) == 0 || (hideDots && shared == n && nodes[c].c == '.')) continue;
+				only = c;
+				branches++;
+			}
+			if (branches != 1) break;
+			*common += nodes[only].c;
+			shared = only;
+		}
+
+		string name(prefix);
+		collect(n, name, kinds, hideDots, limit, out);
+		return total;
+	}
+};
+
+/*
+ * Class: Completer - Complete the word at the cursor from built-in names, programs in PATH
+ * and entries of the working directory. Each set is read the first time it is needed and
+ * then kept current from inotify events, so completing never rereads a large directory
+ */
+class Completer {
+	private:
+
+	struct Watch {
+		bool cwd = false;					// True: the watched directory is the working directory
+		bool path = false;					// True: the watched directory is in PATH
+	};
+
+	Prefix_Trie builtins;					// Names of the built-in commands
+	Prefix_Trie programs;					// Executables in the PATH directories
+	Prefix_Trie files;						// Entries of the working directory
+	bool builtinsRead = false;
+	bool programsRead = false;
+	bool filesRead = false;
+	string pathEnv;							// PATH the programs were read from
+	vector<string> pathDirs;				// Absolute directories of PATH
+	unordered_map<int, Watch> watches;		// inotify watch descriptor -> what it watches
+	int cwdWatch = -1;						// Watch descriptor of the working directory, or -1
+
+	public:
+
+	int fd = -1;							// inotify descriptor, polled with the shell's input
+
+	// Destructor
+	~Completer() {
+		if (fd >= 0) ::close(fd);
+	}
+
+	// Create the inotify descriptor
+	// Output: bool - True: it was created
+	bool open() {
+		fd = inotify_init1(IN_NONBLOCK | IN_CLOEXEC);
+		return fd >= 0;
+	}
+
+	// The working directory changed, so its entries are read again when next needed
+	void dirChanged() {
+		if (cwdWatch >= 0) {
+			Watch& w = watches[cwdWatch];
+			w.cwd = false;
+			if (!w.path) {
+				inotify_rm_watch(fd, cwdWatch);
+				watches.erase(cwdWatch);
+			}
+		}
+		cwdWatch = -1;
+		files.clear();
+		filesRead = false;
+	}
+
+	// Apply the inotify events waiting, adding and removing names
+	void readEvents() {
+		alignas(struct inotify_event) char buf[1 << 16];
+		ssize_t n;
+		while (fd >= 0 && (n = read(fd, buf, sizeof(buf))) > 0) {
+			for (char* p = buf; p < buf + n; p += sizeof(struct inotify_event) + ((struct inotify_event*)p)->len) {
+				struct inotify_event* ev = (struct inotify_event*)p;
+				if (ev->mask & IN_Q_OVERFLOW) {
+					programsRead = filesRead = false;
+					continue;
+				}
+
+				unordered_map<int, Watch>::iterator it = watches.find(ev->wd);
+				if (it == watches.end()) continue;
+				Watch w = it->second;
+
+				if (ev->mask & (IN_IGNORED | IN_DELETE_SELF | IN_MOVE_SELF)) {
+					if (w.cwd) filesRead = false;
+					if (w.path) programsRead = false;
+					if (ev->mask & IN_IGNORED) {
+						watches.erase(it);
+						if (ev->wd == cwdWatch) cwdWatch = -1;
+					}
+					continue;
+				}
+				if (ev->len == 0) continue;
+
+				if (w.cwd) {
+					if (ev->mask & (IN_DELETE | IN_MOVED_FROM))
+						files.erase(ev->name);
+					else if (ev->mask & (IN_CREATE | IN_MOVED_TO))
+						files.insert(ev->name, (ev->mask & IN_ISDIR) ? name_dir : name_file);
+				}
+				if (w.path)
+					recheckProgram(ev->name);
+			}
+		}
+	}
+
+	// Complete the word ending at the cursor
+	// Input: string& line - the line, extended in place, size_t& cursor - position in line, moved past the text added,
+	//		  vector<Name_Match>* choices - set to the matches if they share nothing more
+	// Output: int - the number of matches
+	int complete(string& line, size_t& cursor, vector<Name_Match>* choices) {
+		readEvents();
+
+		// Split the line up to the cursor into words, as the tokenizer would
+		vector<string> words;
+		string word;
+		char quote = 0;
+		bool inWord = false;
+		for (size_t i = 0; i < cursor; i++) {
+			char c = line[i];
+			if (quote != 0) {
+				if (c == quote) quote = 0;
+				else if (quote == '"' && c == '\\' && i + 1 < cursor && (line[i + 1] == '"' || line[i + 1] == '\\')) word += line[++i];
+				else word += c;
+			}
+			else if (c == ' ' || c == '\t' || c == '|' || c == '<' || c == '>') {
+				if (inWord) words.push_back(word);
+				if (c != ' ' && c != '\t') words.push_back(string(1, c));
+				word.clear();
+				inWord = false;
+			}
+			else {
+				inWord = true;
+				if (c == '\\' && i + 1 < cursor) word += line[++i];
+				else if (c == '\'' || c == '"') quote = c;
+				else word += c;
+			}
+		}
+
+		// Pick the names the word is completed from
+		Prefix_Trie* trie;
+		Prefix_Trie listed;
+		string base = word;
+		int kinds = name_any;
+		bool hideDots = false;
+		int role = wordRole(words);
+		size_t slash = word.rfind('/');
+
+		if (role == role_builtin) {
+			readBuiltins();
+			trie = &builtins;
+		}
+		else if (role == role_program && slash == string::npos) {
+			readPrograms();
+			trie = &programs;
+		}
+		else {
+			if (role == role_dir) kinds = name_dir;
+			hideDots = true;
+			if (slash == string::npos) {
+				readFiles();
+				trie = &files;
+			}
+			else {
+				// Other directories are listed when completed in, not kept
+				base = word.substr(slash + 1);
+				listDir(word.substr(0, slash + 1), base, &listed);
+				trie = &listed;
+			}
+		}
+
+		string common;
+		vector<Name_Match> found;
+		int total = trie->complete(base, kinds, hideDots, COMPLETE_LIST_MAX, &common, &found);
+		if (total == 0) return 0;
+
+		// A single match is finished off, otherwise the shared text is added
+		string added;
+		for (char c: common) {
+			if (quote == 0 && strchr(" \t|<>'\"\\", c) != NULL) added += '\\';
+			else if (quote == '"' && (c == '"' || c == '\\')) added += '\\';
+			added += c;
+		}
+		if (total == 1) {
+			if (quote != 0 && found[0].kind != name_dir) added += quote;
+			added += (found[0].kind == name_dir) ? '/' : ' ';
+		}
+		else if (common.empty())
+			*choices = std::move(found);
+
+		line.insert(cursor, added);
+		cursor += added.size();
+		return total;
+	}
+
+	private:
+
+	// Roles a word can have on the command line
+	enum { role_builtin, role_program, role_dir, role_file };
+
+	// Decide what the word after the given ones names
+	// Input: const vector<string>& words - the words before it
+	// Output: int - a role_ value
+	int wordRole(const vector<string>& words) const {
+		size_t first = 0;
+
+		// bench runs a command of its own after the count
+		if (first < words.size() && words[first] == "bench") {
+			first++;
+			if (first < words.size() && words[first] == "--pipeline") first++;
+			first++;
+		}
+		if (first >= words.size()) return role_builtin;
+
+		const string& cmdName = words[first];
+		if (cmdName == "movetodir") return role_dir;
+		if (cmdName != "start" && cmdName != "background" && cmdName != "repeat") return role_file;
+
+		if (words.back() == "|") return role_program;
+
+		// The program follows the options, and the count of repeat
+		size_t i = first + 1;
+		if (cmdName == "repeat" && i < words.size() && words[i] == "-j") i += 2;
+		while (i < words.size() && words[i].compare(0, 2, "--") == 0)
+			i += optionTakesValue(words[i]) ? 2 : 1;
+		if (cmdName == "repeat") i++;
+		return (i >= words.size()) ? role_program : role_file;
+	}
+
+	// Read the built-in names, once
+	void readBuiltins() {
+		if (builtinsRead) return;
+		for (const Builtin& b: BUILTINS)
+			builtins.insert(b.name, name_file);
+		builtins.insert("help", name_file);
+		builtinsRead = true;
+	}
+
+	// Read the executables of PATH, if PATH changed or they were never read
+	void readPrograms() {
+		const char* env = getenv("PATH");
+		string current = (env != NULL) ? env : "/usr/local/bin:/usr/bin:/bin";
+		if (programsRead && current == pathEnv) return;
+
+		// Stop watching the old directories
+		for (unordered_map<int, Watch>::iterator it = watches.begin(); it != watches.end(); ) {
+			it->second.path = false;
+			if (!it->second.cwd) {
+				inotify_rm_watch(fd, it->first);
+				it = watches.erase(it);
+			}
+			else
+				it++;
+		}
+		programs.clear();
+		pathDirs.clear();
+		pathEnv = current;
+
+		// Watch each directory before listing it, so nothing added meanwhile is missed.
+		// Relative entries are left out, as they change with the working directory
+		stringstream stream(current);
+		string dir;
+		while (getline(stream, dir, ':')) {
+			if (dir.empty() || dir[0] != '/') continue;
+			pathDirs.push_back(dir);
+			addWatch(dir.c_str()).path = true;
+
+			DIR* d = opendir(dir.c_str());
+			if (d == NULL) continue;
+			struct dirent* ent;
+			while ((ent = readdir(d)) != NULL) {
+				if (ent->d_type == DT_DIR) continue;
+				struct stat st;
+				if (ent->d_type != DT_REG && (fstatat(dirfd(d), ent->d_name, &st, 0) < 0 || !S_ISREG(st.st_mode)))
+					continue;
+				if (faccessat(dirfd(d), ent->d_name, X_OK, 0) == 0)
+					programs.insert(ent->d_name, name_file);
+			}
+			closedir(d);
+		}
+		programsRead = true;
+	}
+
+	// Read the entries of the working directory, once after each move
+	void readFiles() {
+		if (filesRead) return;
+		files.clear();
+		if (cwdWatch < 0)
+			addWatch(".").cwd = true;
+		listDir("", "", &files);
+		filesRead = true;
+	}
+
+	// Start watching a directory
+	// Input: const char* dir - the directory
+	// Output: Watch& - what the watch is used for, to be marked by the caller
+	Watch& addWatch(const char* dir) {
+		static Watch unwatched;
+		int wd = inotify_add_watch(fd, dir, IN_CREATE | IN_DELETE | IN_MOVED_FROM | IN_MOVED_TO | IN_ATTRIB
+				| IN_DELETE_SELF | IN_MOVE_SELF | IN_ONLYDIR);
+		if (wd < 0) {
+			unwatched = Watch();
+			return unwatched;
+		}
+		if (strcmp(dir, ".") == 0) cwdWatch = wd;
+		return watches[wd];
+	}
+
+	// Add the entries of a directory starting with a prefix to a trie
+	// Input: const string& dir - the directory, ending in / or empty for the working directory,
+	//		  const string& prefix - the start of the names wanted, Prefix_Trie* trie - the trie to add to
+	void listDir(const string& dir, const string& prefix, Prefix_Trie* trie) {
+		DIR* d = opendir(dir.empty() ? "." : dir.c_str());
+		if (d == NULL) return;
+		struct dirent* ent;
+		while ((ent = readdir(d)) != NULL) {
+			if (strcmp(ent->d_name, ".") == 0 || strcmp(ent->d_name, "..") == 0) continue;
+			if (strncmp(ent->d_name, prefix.c_str(), prefix.size()) != 0) continue;
+
+			bool isDir = ent->d_type == DT_DIR;
+			struct stat st;
+			if ((ent->d_type == DT_LNK || ent->d_type == DT_UNKNOWN) && fstatat(dirfd(d), ent->d_name, &st, 0) == 0)
+				isDir = S_ISDIR(st.st_mode);
+			trie->insert(ent->d_name, isDir ? name_dir : name_file);
+		}
+		closedir(d);
+	}
+
+	// A name changed in a PATH directory, so check if any PATH directory still has it as a program
+	// Input: const char* name - the name
+	void recheckProgram(const char* name) {
+		for (const string& dir: pathDirs) {
+			string candidate = dir + "/" + name;
+			struct stat st;
+			if (stat(candidate.c_str(), &st) == 0 && S_ISREG(st.st_mode) && access(candidate.c_str(), X_OK) == 0) {
+				programs.insert(name, name_file);
+				return;
+			}
+		}
+		programs.erase(name);
+	}
+};
+
+/*
+ * Class: Line_Editor - Edit the line typed at the prompt, with history recall and search
+ */
+class Line_Editor {
+	private:
+
+	Command_Stack& history;
+	Completer& completer;
+	History_Index index;
+	const char* prompt = "";
+	string saved;							// Line typed before browsing or searching the history
+	size_t cursor = 0;						// Position in line of the cursor
+	int browse = -1;						// History entry shown by Up and Down, -1 for the typed line
+	int escState = 0;						// 0: no escape, 1: after ESC, 2: after ESC [, 3: after ESC O
+	string escArg;							// Digits of the escape sequence so far
+	bool searching = false;					// True: in reverse search, typed keys extend query
+	string query;							// Text searched for
+	long long match = -1;					// Sequence number of the matching entry, or -1
+	bool failing = false;					// True: the query has no further match
+	size_t columns = 80;					// Width of the terminal at the last redraw
+
+	public:
+
+	string line;							// The line being edited
+
+	// Constructor
+	// Input: Command_Stack& hist - history to recall and search, Completer& comp - completes words on Tab
+	Line_Editor(Command_Stack& hist, Completer& comp) : history(hist), completer(comp) {}
+
+	// Put the terminal in raw mode and show the prompt for a new line
+	// Input: const char* newPrompt - the prompt, const struct termios& cooked - modes of the prompt
+	void begin(const char* newPrompt, const struct termios& cooked) {
+		struct termios raw = cooked;
+		raw.c_iflag &= ~(ICRNL | IXON | BRKINT | INPCK | ISTRIP);
+		raw.c_lflag &= ~(ICANON | ECHO | ISIG | IEXTEN);
+		raw.c_cc[VMIN] = 1;
+		raw.c_cc[VTIME] = 0;
+		tcsetattr(STDIN_FILENO, TCSADRAIN, &raw);
+
+		prompt = newPrompt;
+		line.clear();
+		cursor = 0;
+		browse = -1;
+		escState = 0;
+		searching = false;
+		refresh();
+	}
+
+	// Put the terminal back in the modes of the prompt
+	// Input: const struct termios& cooked - modes of the prompt
+	void end(const struct termios& cooked) {
+		tcsetattr(STDIN_FILENO, TCSADRAIN, &cooked);
+	}
+
+	// Handle one byte typed
+	// Input: char c - the byte
+	// Output: edit_results value - edit_done once Enter ends the line, edit_eof on Ctrl-D at an empty line
+	int feed(char c) {
+		if (escState > 0)
+			return feedEscape(c);
+
+		if (searching) {
+			switch (c) {
+				case 18:						// Ctrl-R, next older match
+					if (!query.empty())
+						findMatch(match >= 0 ? match : history.nextSeq());
+					refresh();
+					return edit_more;
+				case 127: case 8:				// Backspace
+					if (!query.empty()) query.pop_back();
+					failing = false;
+					match = -1;
+					findMatch(history.nextSeq());
+					refresh();
+					return edit_more;
+				case 7: case 3:					// Ctrl-G or Ctrl-C, back to the typed line
+					searching = false;
+					line = saved;
+					cursor = line.size();
+					refresh();
+					return edit_more;
+				default:
+					if ((unsigned char)c >= 32) {
+						query += c;
+						findMatch(match >= 0 ? match + 1 : history.nextSeq());
+						refresh();
+						return edit_more;
+					}
+					// Any other key takes the match and acts on it
+					acceptMatch();
+					break;
+			}
+		}
+
+		switch (c) {
+			case '\r': case '\n':
+				cursor = line.size();
+				refresh();
+				cout << "\r\n" << flush;
+				return edit_done;
+			case 4:								// Ctrl-D, end of input or delete
+				if (line.empty()) {
+					cout << "\r\n" << flush;
+					return edit_eof;
+				}
+				if (cursor < line.size()) line.erase(cursor, 1);
+				break;
+			case 3:								// Ctrl-C, discard the line
+				line.clear();
+				cursor = 0;
+				browse = -1;
+				cout << "^C\r\n";
+				break;
+			case 127: case 8:					// Backspace
+				if (cursor > 0) line.erase(--cursor, 1);
+				break;
+			case 1: cursor = 0; break;			// Ctrl-A
+			case 5: cursor = line.size(); break;	// Ctrl-E
+			case 2: if (cursor > 0) cursor--; break;	// Ctrl-B
+			case 6: if (cursor < line.size()) cursor++; break;	// Ctrl-F
+			case 21:							// Ctrl-U, delete to the start
+				line.erase(0, cursor);
+				cursor = 0;
+				break;
+			case 11:							// Ctrl-K, delete to the end
+				line.erase(cursor);
+				break;
+			case 16: recall(1); break;			// Ctrl-P
+			case 14: recall(-1); break;			// Ctrl-N
+			case 12:							// Ctrl-L, clear the screen
+				cout << "\x1b[H\x1b[2J";
+				break;
+			case 9: {							// Tab, complete the word at the cursor
+				vector<Name_Match> choices;
+				int total = completer.complete(line, cursor, &choices);
+				if (choices.size() > 1)
+					showChoices(choices, total);
+				break;
+			}
+			case 18:							// Ctrl-R, start searching
+				searching = true;
+				failing = false;
+				query.clear();
+				match = -1;
+				saved = line;
+				break;
+			case 27:
+				escState = 1;
+				escArg.clear();
+				return edit_more;
+			default:
+				if ((unsigned char)c < 32) return edit_more;
+				line.insert(cursor++, 1, c);
+				// Typing at the end of a line that fits only needs the byte echoed
+				if (cursor == line.size() && strlen(prompt) + cursor < columns) {
+					cout << c << flush;
+					return edit_more;
+				}
+				break;
+		}
+
+		refresh();
+		return edit_more;
+	}
+
+	private:
+
+	// Handle a byte of an escape sequence: arrows, Home, End and Delete
+	// Input: char c - the byte
+	// Output: edit_results value
+	int feedEscape(char c) {
+		if (escState == 1) {
+			escState = (c == '[') ? 2 : (c == 'O') ? 3 : 0;
+			return edit_more;
+		}
+		if (c >= '0' && c <= '9' && escState == 2) {
+			escArg += c;
+			return edit_more;
+		}
+		escState = 0;
+		if (searching) acceptMatch();
+
+		switch (c) {
+			case 'A': recall(1); break;
+			case 'B': recall(-1); break;
+			case 'C': if (cursor < line.size()) cursor++; break;
+			case 'D': if (cursor > 0) cursor--; break;
+			case 'H': cursor = 0; break;
+			case 'F': cursor = line.size(); break;
+			case '~':
+				if (escArg == "1" || escArg == "7") cursor = 0;
+				else if (escArg == "4" || escArg == "8") cursor = line.size();
+				else if (escArg == "3" && cursor < line.size()) line.erase(cursor, 1);
+				break;
+		}
+		refresh();
+		return edit_more;
+	}
+
+	// Show an older (Up) or newer (Down) command from the history
+	// Input: int step - 1 for older, -1 for newer
+	void recall(int step) {
+		int to = browse + step;
+		if (to < -1 || to >= history.size()) return;
+
+		if (browse == -1) saved = line;
+		browse = to;
+		line = (browse == -1) ? saved : string(history.entry(browse));
+		cursor = line.size();
+	}
+
+	// Search for the query in entries older than a given one
+	// Input: long long before - sequence number to search below
+	void findMatch(long long before) {
+		long long found = index.search(history, query, before);
+		failing = (found < 0 && !query.empty());
+		if (found >= 0) match = found;
+	}
+
+	// Leave search, editing the matching entry
+	void acceptMatch() {
+		searching = false;
+		if (match < 0) return;
+
+		line = history.entry(history.nextSeq() - 1 - match);
+		size_t at = line.find(query);
+		cursor = (at == string::npos) ? line.size() : at;
+	}
+
+	// List the names an ambiguous completion could be, in columns below the line
+	// Input: const vector<Name_Match>& choices - the names, int total - the number of matches, at least choices.size()
+	void showChoices(const vector<Name_Match>& choices, int total) {
+		size_t widest = 0;
+		for (const Name_Match& m: choices)
+			widest = max(widest, m.name.size() + (m.kind == name_dir));
+		size_t perRow = max<size_t>(1, columns / (widest + 2));
+
+		string out = "\r\n";
+		for (size_t i = 0; i < choices.size(); i++) {
+			string shown = choices[i].name + (choices[i].kind == name_dir ? "/" : "");
+			out += shown;
+			if ((i + 1) % perRow == 0 || i + 1 == choices.size())
+				out += "\r\n";
+			else
+				out.append(widest + 2 - shown.size(), ' ');
+		}
+		if (total > (int)choices.size())
+			out += "(" + to_string(total - choices.size()) + " more)\r\n";
+		cout << out;
+	}
+
+	// Redraw the line, scrolled sideways to keep the cursor on screen
+	void refresh() {
+		struct winsize ws;
+		columns = (ioctl(STDOUT_FILENO, TIOCGWINSZ, &ws) == 0 && ws.ws_col > 0) ? ws.ws_col : 80;
+		size_t cols = columns;
+
+		string shownPrompt = prompt;
+		string_view text = line;
+		size_t pos = cursor;
+		string shown;
+		if (searching) {
+			shownPrompt = string(failing ? "(failing reverse-i-search)`" : "(reverse-i-search)`") + query + "': ";
+			if (match >= 0) {
+				shown = history.entry(history.nextSeq() - 1 - match);
+				text = shown;
+			}
+			else
+				text = "";
+			size_t at = text.find(query);
+			pos = (at == string_view::npos) ? text.size() : at;
+		}
+
+		// Keep at least one column for the cursor
+		size_t plen = min(shownPrompt.size(), cols - 1);
+		size_t width = cols - plen - 1;
+		size_t start = (pos > width) ? pos - width : 0;
+
+		string out = "\r";
+		out.append(shownPrompt, 0, plen);
+		out.append(text.substr(start, width));
+		out += "\x1b[0K\r";
+		if (plen + pos - start > 0)
+			out += "\x1b[" + to_string(plen + pos - start) + "C";
+		cout << out << flush;
+	}
+};
+
+/*
+ * Class: Path_Cache - Locations of programs found in PATH, kept until a PATH directory changes
+ */
+class Path_Cache {
+	private:
+
+	unordered_map<string, string> paths;	// Program name -> full path, or empty if not found
+	string pathEnv;							// PATH the directories were read from
+	vector<string> dirs;					// Directories of PATH, in search order
+	vector<struct timespec> mtimes;			// Modification time of each directory when last checked
+	bool checked = false;					// True once the directories were checked for this command
+
+	public:
+
+	long long hits = 0;						// Lookups answered from the cache
+	long long misses = 0;					// Lookups that searched PATH
+
+	// Start a new command, so the next lookup checks the PATH directories once
+	void beginCommand() {
+		checked = false;
+	}
+
+	// Forget every cached location
+	// Output: int - the number of locations forgotten
+	int clear() {
+		int n = paths.size();
+		paths.clear();
+		pathEnv.clear();
+		dirs.clear();
+		mtimes.clear();
+		checked = false;
+		return n;
+	}
+
+	// The working directory changed, so forget locations found through relative PATH entries
+	void dirChanged() {
+		for (const string& dir: dirs) {
+			if (dir.empty() || dir[0] != '/') {
+				clear();
+				return;
+			}
+		}
+	}
+
+	// Find the full path of a program
+	// Input: const char* name - the program, used as is if it contains a slash
+	// Output: the full path, or NULL if it is not in PATH
+	const char* lookup(const char* name) {
+		if (strchr(name, '/') != NULL) return name;
+
+		if (!checked) {
+			revalidate();
+			checked = true;
+		}
+
+		unordered_map<string, string>::iterator it = paths.find(name);
+		if (it != paths.end()) {
+			hits++;
+			return it->second.empty() ? NULL : it->second.c_str();
+		}
+
+		misses++;
+		string& found = paths[name];
+		for (const string& dir: dirs) {
+			string candidate = dir + "/" + name;
+			struct stat st;
+			if (stat(candidate.c_str(), &st) == 0 && S_ISREG(st.st_mode) && access(candidate.c_str(), X_OK) == 0) {
+				found = candidate;
+				break;
+			}
+		}
+		return found.empty() ? NULL : found.c_str();
+	}
+
+	private:
+
+	// Drop the cache if PATH or any of its directories changed since the last check
+	void revalidate() {
+		const char* env = getenv("PATH");
+		string current = (env != NULL) ? env : "/usr/local/bin:/usr/bin:/bin";
+
+		if (current != pathEnv) {
+			paths.clear();
+			pathEnv = current;
+			dirs.clear();
+
+			stringstream stream(current);
+			string dir;
+			while (getline(stream, dir, ':'))
+				dirs.push_back(dir.empty() ? "." : dir);
+			mtimes.assign(dirs.size(), {-1, 0});
+		}
+
+		// A program added to or removed from a directory changes its mtime
+		for (size_t i = 0; i < dirs.size(); i++) {
+			struct stat st;
+			struct timespec mtime = {-1, 0};
+			if (stat(dirs[i].c_str(), &st) == 0)
+				mtime = st.st_mtim;
+
+			if (mtime.tv_sec != mtimes[i].tv_sec || mtime.tv_nsec != mtimes[i].tv_nsec) {
+				paths.clear();
+				mtimes[i] = mtime;
+			}
+		}
+	}
+};
+
+/*
+ * Struct: Content_Hash - 128-bit hash of a stream of bytes, in two 64-bit lanes
+ */
+struct Content_Hash {
+	uint64_t a = 14695981039346656037ull;	// FNV-1a lane
+	uint64_t b = 0x9e3779b97f4a7c15ull;		// Lane with a different multiplier, so collisions of one are not collisions of both
+
+	// Add bytes to the hash
+	// Input: const void* data - the bytes, size_t n - how many
+	void add(const void* data, size_t n) {
+		const unsigned char* p = (const unsigned char*)data;
+		for (size_t i = 0; i < n; i++) {
+			a = (a ^ p[i]) * 1099511628211ull;
+			b = (b ^ p[i]) * 0xff51afd7ed558ccdull;
+		}
+	}
+
+	// Add a field, preceded by its length so adjacent fields cannot run into each other
+	// Input: string_view s - the field
+	void addField(string_view s) {
+		uint64_t n = s.size();
+		add(&n, sizeof(n));
+		add(s.data(), s.size());
+	}
+
+	// Add the identity and modification time of a file
+	// Input: const struct stat& st - the file's status
+	void addStat(const struct stat& st) {
+		int64_t fields[] = {(int64_t)st.st_dev, (int64_t)st.st_ino, (int64_t)st.st_size,
+			(int64_t)st.st_mtim.tv_sec, (int64_t)st.st_mtim.tv_nsec};
+		add(fields, sizeof(fields));
+	}
+
+	// Output: the hash as 32 hex digits
+	string hex() const {
+		char out[33];
+		snprintf(out, sizeof(out), "%016llx%016llx", (unsigned long long)mix(a), (unsigned long long)mix(b ^ a));
+		return out;
+	}
+
+	private:
+
+	// Spread every bit of a lane over the whole word (the splitmix64 finalizer)
+	static uint64_t mix(uint64_t x) {
+		x = (x ^ (x >> 30)) * 0xbf58476d1ce4e5b9ull;
+		x = (x ^ (x >> 27)) * 0x94d049bb133111ebull;
+		return x ^ (x >> 31);
+	}
+};
+
+/*
+ * Class: Result_Cache - Output and exit status of earlier start --cache runs, kept on disk
+ * keys/KEY holds the exit status and the hash of the output, blobs/HASH holds the output,
+ * so runs with the same output share one blob. Using an entry updates its time for eviction
+ */
+class Result_Cache {
+	private:
+
+	string dir;								// Cache directory, holding keys/, blobs/ and tmp/
+	bool opened = false;					// True once the directories were created
+	long long maxBytes = CACHE_MAX_DEFAULT;	// Size the entries are evicted down to
+
+	public:
+
+	long long hits = 0;						// Runs replayed from the cache
+	long long misses = 0;					// Runs that started the program
+
+	// Find and create the cache directories, on first use
+	// The directory is MYSH_CACHE_DIR, else $XDG_CACHE_HOME/mysh, else ~/.cache/mysh
+	// Output: bool - True: the cache can be used
+	bool open() {
+		if (opened) return true;
+
+		const char* env;
+		if ((env = getenv("MYSH_CACHE_DIR")) != NULL && *env != '\0')
+			dir = env;
+		else if ((env = getenv("XDG_CACHE_HOME")) != NULL && *env != '\0')
+			dir = string(env) + "/mysh";
+		else if ((env = getenv("HOME")) != NULL && *env != '\0')
+			dir = string(env) + "/.cache/mysh";
+		else {
+			cout << OUT_INDENT << "No cache directory, set MYSH_CACHE_DIR" << '\n';
+			return false;
+		}
+
+		const char* max = getenv("MYSH_CACHE_MAX");
+		if (max != NULL && !parseSize(max, &maxBytes)) {
+			cout << OUT_INDENT << "Invalid MYSH_CACHE_MAX: " << max << '\n';
+			return false;
+		}
+
+		for (const char* sub: {"/keys", "/blobs", "/tmp"}) {
+			error_code ec;
+			filesystem::create_directories(dir + sub, ec);
+			if (ec) {
+				cout << OUT_INDENT << "Could not create " << dir << sub << ": " << ec.message() << '\n';
+				return false;
+			}
+		}
+		opened = true;
+		return true;
+	}
+
+	// Compute the key of a run from what decides its output
+	// Input: char** args - program and arguments, const char* path - the program file,
+	//        const string& cwd - working directory, const vector<string>& inputs - files the program reads
+	// Output: the key as hex, or empty if the program file does not exist
+	string key(char** args, const char* path, const string& cwd, const vector<string>& inputs) const {
+		struct stat st;
+		if (stat(path, &st) != 0) return "";
+
+		Content_Hash h;
+		for (int i = 0; args[i] != NULL; i++)
+			h.addField(args[i]);
+		h.addField(cwd);
+		h.addField(path);
+		h.addStat(st);
+		for (const string& file: inputs) {
+			h.addField(file);
+			if (stat(file.c_str(), &st) == 0)
+				h.addStat(st);
+			else
+				h.addField("");
+		}
+		return h.hex();
+	}
+
+	// Write the stored output of a run to stdout
+	// Input: const string& key - the run, int* code - set to its exit status
+	// Output: bool - True: the run was in the cache
+	bool replay(const string& key, int* code) {
+		string keyPath = dir + "/keys/" + key;
+		string blob;
+		ifstream in(keyPath);
+		if (!in) return false;
+		if (!(in >> *code >> blob) || *code < 0 || *code > 255) {
+			// Without its exit status the output cannot stand in for a run
+			unlink(keyPath.c_str());
+			return false;
+		}
+
+		string blobPath = dir + "/blobs/" + blob;
+		int fd = ::open(blobPath.c_str(), O_RDONLY | O_CLOEXEC);
+		struct stat st;
+		if (fd < 0 || fstat(fd, &st) < 0) {
+			// The output was evicted, so the key is of no use
+			if (fd >= 0) ::close(fd);
+			unlink(keyPath.c_str());
+			return false;
+		}
+
+		cout.flush();
+		copyOut(fd, st.st_size);
+		::close(fd);
+		utimensat(AT_FDCWD, keyPath.c_str(), NULL, 0);
+		utimensat(AT_FDCWD, blobPath.c_str(), NULL, 0);
+		return true;
+	}
+
+	// Name a file for the output of a run about to start
+	// Input: const string& key - the run
+	// Output: the path, unique to this shell
+	string tempPath(const string& key) const {
+		return dir + "/tmp/" + key + "." + to_string(getpid());
+	}
+
+	// Keep the output of a run that exited normally, then evict down to the size limit
+	// Input: const string& key - the run, const string& tmpPath - file holding its output,
+	//        int code - its exit status
+	void store(const string& key, const string& tmpPath, int code) {
+		int fd = ::open(tmpPath.c_str(), O_RDONLY | O_CLOEXEC);
+		if (fd < 0) return;
+
+		Content_Hash h;
+		unique_ptr<char[]> buf(new char[SCRIPT_CHUNK]);
+		long long size = 0;
+		ssize_t n;
+		while ((n = read(fd, buf.get(), SCRIPT_CHUNK)) > 0) {
+			h.add(buf.get(), n);
+			size += n;
+		}
+		::close(fd);
+		if (n < 0 || size > maxBytes) {
+			unlink(tmpPath.c_str());
+			return;
+		}
+
+		// Both renames replace atomically, so another shell never sees half an entry
+		string blobPath = dir + "/blobs/" + h.hex();
+		string keyTemp = tmpPath + ".key";
+		ofstream out(keyTemp);
+		out << code << ' ' << h.hex() << '\n';
+		out.close();
+		if (!out || rename(tmpPath.c_str(), blobPath.c_str()) < 0 ||
+			rename(keyTemp.c_str(), (dir + "/keys/" + key).c_str()) < 0) {
+			unlink(tmpPath.c_str());
+			unlink(keyTemp.c_str());
+			return;
+		}
+		evict();
+	}
+
+	private:
+
+	// Remove the least recently used keys and blobs until the cache fits in maxBytes
+	void evict() {
+		struct Entry {
+			struct timespec used;
+			off_t size;
+			string path;
+		};
+		vector<Entry> entries;
+		long long total = 0;
+
+		for (const char* sub: {"/keys/", "/blobs/"}) {
+			string base = dir + sub;
+			DIR* d = opendir(base.c_str());
+			if (d == NULL) continue;
+			struct dirent* e;
+			while ((e = readdir(d)) != NULL) {
+				struct stat st;
+				if (e->d_name[0] == '.' || fstatat(dirfd(d), e->d_name, &st, 0) < 0) continue;
+				entries.push_back({st.st_mtim, st.st_size, base + e->d_name});
+				total += st.st_size;
+			}
+			closedir(d);
+		}
+		if (total <= maxBytes) return;
+
+		sort(entries.begin(), entries.end(), [](const Entry& x, const Entry& y) {
+			return x.used.tv_sec != y.used.tv_sec ? x.used.tv_sec < y.used.tv_sec : x.used.tv_nsec < y.used.tv_nsec;
+		});
+		for (const Entry& e: entries) {
+			if (total <= maxBytes) break;
+			if (unlink(e.path.c_str()) == 0) total -= e.size;
+		}
+	}
+
+	// Copy a file to stdout, in the kernel when it can
+	// Input: int fd - the file, off_t size - its length
+	static void copyOut(int fd, off_t size) {
+		off_t offset = 0;
+		while (offset < size) {
+			ssize_t n = sendfile(STDOUT_FILENO, fd, &offset, size - offset);
+			if (n > 0) continue;
+			if (n < 0 && errno == EINTR) continue;
+			break;
+		}
+
+		// Fall back to read and write where sendfile does not apply
+		char buf[SCRIPT_CHUNK];
+		ssize_t n;
+		while (offset < size && (n = pread(fd, buf, sizeof(buf), offset)) > 0) {
+			for (ssize_t done = 0; done < n; ) {
+				ssize_t w = write(STDOUT_FILENO, buf + done, n - done);
+				if (w < 0 && errno == EINTR) continue;
+				if (w <= 0) return;
+				done += w;
+			}
+			offset += n;
+		}
+	}
+};
+
+/*
+ * Class: Work_Dir - The working directory, held open and its path cached
+ */
+class Work_Dir {
+	public:
+
+	int fd = -1;		// Open directory of the working directory
+	string path;		// Path of the working directory, ending in "/"
+
+	~Work_Dir() {
+		if (fd >= 0) ::close(fd);
+	}
+
+	// Open the directory the shell was started in
+	// Output: bool - True: the directory was opened
+	bool open() {
+		fd = ::open(".", O_RDONLY | O_DIRECTORY | O_CLOEXEC);
+		if (fd < 0) return false;
+
+		char buf[PATH_MAX];
+		if (getcwd(buf, sizeof(buf)) == NULL) return false;
+		path = buf;
+		if (path.back() != '/') path += "/";
+		return true;
+	}
+
+	// Move to a directory given relative to the working directory, or absolute
+	// Input: const char* dir - the directory to move to
+	// Output: int - 0 on success, otherwise the errno of the failure
+	int change(const char* dir) {
+		int newFd = openat(fd, dir, O_RDONLY | O_DIRECTORY | O_CLOEXEC);
+		if (newFd < 0) return errno;
+		if (fchdir(newFd) < 0) {
+			int err = errno;
+			::close(newFd);
+			return err;
+		}
+
+		::close(fd);
+		fd = newFd;
+		path = resolve(dir);
+		return 0;
+	}
+
+	private:
+
+	// Join a directory onto the cached path, removing "." and ".." lexically
+	// Input: string_view dir - the directory moved to
+	// Output: string - the new path, ending in "/"
+	string resolve(string_view dir) const {
+		string result = dir[0] == '/' ? "/" : path;
+		while (!dir.empty()) {
+			size_t slash = dir.find('/');
+			string_view part = dir.substr(0, slash);
+			dir = slash == string_view::npos ? string_view() : dir.substr(slash + 1);
+
+			if (part.empty() || part == ".") continue;
+			if (part == "..") {
+				if (result.size() > 1) result.erase(result.rfind('/', result.size() - 2) + 1);
+				continue;
+			}
+			result.append(part.data(), part.size());
+			result += "/";
+		}
+		return result;
+	}
+};
+
+/*
+ * Struct: Spawn_Options - Options given to start and background before the program
+ */
+struct Spawn_Options {
+	long long pipeSize = 0;					// Buffer size of each pipe in a pipeline, 0 for the default
+	bool pinned = false;					// True: run only on the CPUs in cpus
+	cpu_set_t cpus;							// CPUs to run on, if pinned
+	int numaNode = -1;						// NUMA node to allocate memory from, -1 for any
+	string cgroup;							// cgroup v2 leaf to start in, empty for the shell's own
+	long long memMax = 0;					// memory.max of the cgroup, 0 to leave it unchanged
+	int cgroupFd = -1;						// The cgroup directory, once opened
+	bool quiet = false;						// True: do not print the pid of each process started
+
+	Spawn_Options() = default;
+	Spawn_Options(const Spawn_Options&) = delete;	// owns cgroupFd
+
+	// Destructor
+	~Spawn_Options() {
+		if (cgroupFd >= 0) ::close(cgroupFd);
+	}
+
+	// Test if children must be placed before they exec, which posix_spawn cannot do
+	// Output: bool - True: an affinity, NUMA node or cgroup was given
+	bool placed() const {
+		return pinned || numaNode >= 0 || cgroupFd >= 0;
+	}
+};
+
+/*
+ * Struct: Redirect - A file opened onto a descriptor of a pipeline stage
+ */
+struct Redirect {
+	int fd;									// Descriptor of the stage the file replaces
+	int flags;								// Flags the file is opened with
+	const char* path;						// File name, owned by the Command
+	bool sequential = false;				// {seq}: advise the kernel the file is read or written in order
+	bool noreuse = false;					// {noreuse}: advise the kernel the data is used once
+	bool dontneed = false;					// {dontneed}: drop the file from the page cache when the job exits
+	long long prealloc = 0;					// {prealloc=SIZE}: reserve disk space for output up front
+};
+
+/*
+ * Class: Pipeline - The stages of a command line, split at each |
+ */
+class Pipeline {
+	public:
+
+	vector<char*> argv;						// Tokens of every stage, each stage null terminated
+	vector<char**> stages;					// First token of each stage
+	vector<vector<Redirect>> redirects;		// Redirections of each stage
+	string error;							// Why the command line is not a valid pipeline, or empty
+
+	// Constructor
+	// Input: const Command& cmd - the Command, int first - index in cmd.args of the first stage
+	Pipeline(const Command& cmd, int first) {
+		vector<int> starts = {0};
+		redirects.resize(1);
+
+		for (int i = first; i < cmd.args.size(); i++) {
+			int kind = cmd.kind(i + 1);
+			if (kind == token_word)
+				argv.push_back(cmd.execArgs()[i]);
+			else if (kind == token_pipe) {
+				argv.push_back(NULL);
+				starts.push_back(argv.size());
+				redirects.resize(redirects.size() + 1);
+			}
+			else {
+				// A redirection takes the next token as its file name
+				if (i + 1 >= cmd.args.size() || cmd.kind(i + 2) != token_word) {
+					error = "missing file name after " + string(cmd.args[i]);
+					return;
+				}
+				Redirect redirect;
+				if (!makeRedirect(kind, cmd.args[i], cmd.execArgs()[i + 1], &redirect)) {
+					error = "invalid redirection " + string(cmd.args[i]);
+					return;
+				}
+				redirects.back().push_back(redirect);
+				i++;
+			}
+		}
+		argv.push_back(NULL);
+
+		for (int s: starts) {
+			if (argv[s] == NULL) {
+				error = "empty pipeline stage";
+				return;
+			}
+			stages.push_back(&argv[s]);
+		}
+	}
+
+	// Fill in a redirection from its operator token
+	// Input: int kind - token_kinds value of the operator, string_view op - the operator with its hints,
+	//		  const char* path - the file name, Redirect* redirect - set to the redirection
+	// Output: bool - True: the hints were valid
+	static bool makeRedirect(int kind, string_view op, const char* path, Redirect* redirect) {
+		redirect->path = path;
+		switch (kind) {
+			case token_redirect_in:
+				redirect->fd = STDIN_FILENO;
+				redirect->flags = O_RDONLY;
+				break;
+			case token_redirect_out:
+			case token_redirect_err:
+				redirect->fd = (kind == token_redirect_out) ? STDOUT_FILENO : STDERR_FILENO;
+				redirect->flags = O_WRONLY | O_CREAT | O_TRUNC;
+				break;
+			default:
+				redirect->fd = (kind == token_redirect_append) ? STDOUT_FILENO : STDERR_FILENO;
+				redirect->flags = O_WRONLY | O_CREAT | O_APPEND;
+				break;
+		}
+
+		size_t open = op.find('{');
+		if (open == string_view::npos) return true;
+		if (op.back() != '}') return false;
+
+		// Hints are separated by commas
+		string_view hints = op.substr(open + 1, op.size() - open - 2);
+		while (!hints.empty()) {
+			size_t comma = hints.find(',');
+			string_view hint = hints.substr(0, comma);
+			hints = (comma == string_view::npos) ? string_view() : hints.substr(comma + 1);
+
+			if (hint == "seq")
+				redirect->sequential = true;
+			else if (hint == "noreuse")
+				redirect->noreuse = true;
+			else if (hint == "dontneed")
+				redirect->dontneed = true;
+			else if (hint.substr(0, 9) == "prealloc=" && redirect->fd != STDIN_FILENO) {
+				if (!parseSize(hint.substr(9), &redirect->prealloc))
+					return false;
+			}
+			else
+				return false;
+		}
+		return true;
+	}
+
+	// Test if the command line is a valid pipeline
+	// Output: bool - True: every stage has a program
+	bool valid() const {
+		return error.empty();
+	}
+};
+
+/*-----------------------------------------------------------------------
+		End of Classes
+-----------------------------------------------------------------------*/
+
+// Function prototypes for main program
+void run_sh();
+string getInput();
+void recordFirstPrompt();
+bool executeCommand(const Command& cmd);
+void start(const Command& cmd);
+bool startCached(char** args, const string& programPath, const vector<string>& inputs, const Spawn_Options& opts);
+int background(const Command& cmd);
+pid_t launchBackground(char** args, const string& cmdLine, const Spawn_Options& opts);
+bool parseSpawnOptions(const Command& cmd, int* idx, Spawn_Options* opts);
+bool parseCpuList(string_view s, cpu_set_t* cpus);
+bool openCgroup(Spawn_Options* opts);
+bool writeCgroupFile(int dirFd, const char* name, const string& value);
+pid_t spawnPlaced(const char* path, char** args, const Spawn_Options& opts, int* err);
+vector<pid_t> launchPipeline(Pipeline& pipeline, const Spawn_Options& opts, const char* firstPath, bool foreground);
+int runTeeStage(char** args, long long pipeSize);
+int openRedirect(const Redirect& r);
+void dropCachedFiles(Job& job);
+bool moveBytes(int in, int out, size_t n);
+bool parseCount(string_view s, int* n);
+void whereami();
+bool moveToDir(const Command& cmd);
+pid_t spawnProcess(const char* path, char** args, Spawn_Actions* actions, int* err);
+void dalek(const Command& cmd);
+void reapChildren();
+void recordExit(const Child_Exit& ex);
+void waitForeground(const vector<pid_t>& pids);
+int exitCode(int status);
+void initJobControl();
+void giveTerminal(pid_t pgid);
+void resetChildSignals();
+void resumeJob(const Command& cmd, bool foreground);
+bool startedBefore(const Job& a, const Job& b);
+bool waitForInput();
+void listJobs();
+void showStats(const Command& cmd);
+void bench(const Command& cmd);
+void benchPipeline(int n, const string& line);
+void printLatencies(vector<double>& us, double seconds);
+void printUsage(const Job& job);
+double toSeconds(const struct timeval& tv);
+void dalekall();
+void dalekallWait(double timeout);
+bool signalJob(int pidfd, pid_t pid, int sig, vector<pid_t>* groups);
+bool parseDuration(string_view s, double* seconds);
+void repeat(const Command& cmd);
+void runGraph(const Command& cmd);
+bool loadGraph(const char* path, vector<Graph_Job>* graph);
+bool checkGraph(const vector<Graph_Job>& graph);
+void skipAfter(vector<Graph_Job>& graph, const Graph_Job& failed);
+void introMessage();
+bool getHelp(const Command& cmd);
+int runDaemon(const char* path);
+int openDaemonSocket(const char* path);
+bool readClient(Daemon_Client& client);
+bool writeClient(Daemon_Client& client);
+string runRemote(string_view line, int* code);
+
+/*
+ * Struct: Daemon_Client - A connection to mysh --daemon
+ */
+struct Daemon_Client {
+	int fd;
+	string in;								// Bytes read, up to the end of the last whole request
+	string out;								// Replies not yet written
+	bool writing = false;					// True: waiting for the socket to become writable
+	bool closing = false;					// True: the client shut down its end, close once the replies are out
+};
+
+/*
+ * Struct: Graph_Job - One job of a graph given to run
+ */
+struct Graph_Job {
+	string name;
+	string cmdLine;							// What to run, as given to background
+	int lineNum;							// Line of the graph file the job is on
+	vector<int> after;						// Jobs that must succeed first
+	vector<int> next;						// Jobs that come after this one
+	int waiting = 0;						// Jobs in after that have not succeeded yet
+	int state = graph_pending;				// graph_states value
+	pid_t pid = -1;
+	int status = -1;						// Status as returned by wait4, once done
+	double seconds = 0;						// Time from start to exit
+};
+
+/*
+ * Struct: Shell_Metrics - Timings of the shell itself, and totals over every job it reaped
+ */
+struct Shell_Metrics {
+	struct timespec launched;				// CLOCK_MONOTONIC time main() was entered
+	double firstPromptMs = -1;				// Milliseconds from launch until the first prompt
+	long long jobsDone = 0;					// Processes reaped
+	double wallSeconds = 0;					// Time from start to exit, summed over the processes
+	double userSeconds = 0;					// User CPU time of the processes
+	double sysSeconds = 0;					// System CPU time of the processes
+	long maxRssKb = 0;						// Largest resident set of any process
+	long long minorFaults = 0;				// Page faults served without I/O
+	long long majorFaults = 0;				// Page faults that needed I/O
+	long long voluntarySwitches = 0;		// Context switches from waiting on a resource
+	long long involuntarySwitches = 0;		// Context switches from being preempted
+};
+
+// Global variables
+Output_Buffer shell_out(STDOUT_FILENO); // Buffers everything written to cout
+Shell_Metrics metrics;   // Timings of the shell itself
+Tracer tracer;           // Spans of shell work, when MYSH_TRACE is set
+Command_Stack history;   // History command stack
+Completer completer;                 // Completes words typed at a terminal
+Line_Editor editor(history, completer); // Edits lines typed at a terminal
+Work_Dir work_dir;	     // The current working directory
+int status;			     // The status of the program - 1: Run, 0: End
+int last_status = 0;     // Exit code of the last command, as sh would give it for $?
+Job_Table jobs;                      // The child processes currently running
+deque<Job> finished_jobs{};          // The most recent jobs to exit, newest last
+int unreported_jobs = 0;             // Background jobs at the end of finished_jobs not yet listed by jobs
+vector<string> job_notices;          // Background jobs that finished, printed before the next prompt
+Child_Reaper reaper;                 // Collects exited children
+Input_Reader input(STDIN_FILENO);    // Reads lines typed into the shell
+Path_Cache path_cache;               // Locations of programs found in PATH
+Result_Cache result_cache;           // Output of earlier start --cache runs
+int events_fd = -1;                  // epoll set watching input, the reaper and completion
+pid_t shell_pgid;                    // Process group of the shell, which owns the terminal at the prompt
+struct termios shell_tmodes;         // Terminal modes at the prompt, restored after each foreground job
+
+int main(int argc, char** argv) {
+	clock_gettime(CLOCK_MONOTONIC, &metrics.launched);
+	status = 1; // Set status to run (1)
+	shell_out.install();
+
+	// Read commands from a script given with -f, a socket given with --daemon, otherwise from stdin
+	int inputFd = STDIN_FILENO;
+	const char* daemonPath = NULL;
+	if (argc == 3 && strcmp(argv[1], "-f") == 0) {
+		inputFd = ::open(argv[2], O_RDONLY | O_CLOEXEC);
+		if (inputFd < 0) {
+			cout << OUT_INDENT << "Could not open script: " << argv[2] << '\n';
+			return 1;
+		}
+		input.attach(inputFd);
+	}
+	else if (argc == 3 && strcmp(argv[1], "--daemon") == 0)
+		daemonPath = argv[2];
+	else if (argc != 1) {
+		cout << OUT_INDENT << "Usage: " << argv[0] << " [-f script | --daemon socket]" << '\n';
+		return 1;
+	}
+
+	// Record where time goes inside the shell, if asked
+	const char* tracePath = getenv("MYSH_TRACE");
+	if (tracePath != NULL && *tracePath != '\0' && !tracer.open(tracePath))
+		cout << OUT_INDENT << "Could not open trace file: " << tracePath << '\n';
+
+	// Scripts, piped input and the daemon run without the intro, prompts or history
+	input.interactive = daemonPath == NULL && inputFd == STDIN_FILENO && isatty(STDIN_FILENO);
+	shell_pgid = getpgrp();
+	if (input.interactive) {
+		initJobControl();
+		introMessage();
+	}
+
+	// Hold the starting directory, and keep the history file there when moving away
+	if (!work_dir.open()) {
+		cout << OUT_INDENT << "Failed to open the current directory" << '\n';
+		return 1;
+	}
+	history.setDirectory(work_dir.path);
+
+	// Get command history from file mysh_history.txt
+	if (input.interactive)
+		history.readFromFile();
+
+	// Watch input and child exits from one epoll set
+	events_fd = epoll_create1(EPOLL_CLOEXEC);
+	if (events_fd < 0 || !reaper.open()) {
+		cout << OUT_INDENT << "Failed to set up child reaping" << '\n';
+		return 1;
+	}
+	struct epoll_event ev = {};
+	ev.events = EPOLLIN;
+	ev.data.fd = reaper.fd;
+	epoll_ctl(events_fd, EPOLL_CTL_ADD, reaper.fd, &ev);
+
+	if (daemonPath != NULL) {
+		int result = runDaemon(daemonPath);
+		tracer.close();
+		cout.flush();
+		return result;
+	}
+
+	if (input.interactive && completer.open()) {
+		ev.data.fd = completer.fd;
+		epoll_ctl(events_fd, EPOLL_CTL_ADD, completer.fd, &ev);
+	}
+	ev.data.fd = inputFd;
+	if (epoll_ctl(events_fd, EPOLL_CTL_ADD, inputFd, &ev) < 0)
+		input.pollable = false; // regular files are always readable
+
+	run_sh();
+
+	// Write any command history not yet in mysh_history.txt
+	if (input.interactive)
+		history.flushToFile();
+
+	tracer.close();
+	cout.flush();
+
+	// Like sh, a script exits with the status of its last command
+	return input.interactive ? 0 : last_status;
+}
+
+// Run the shell until byebye entered or a fatal error occurs
+void run_sh() {
+	string inputString;
+
+	// Run the shell while the status continues
+	while (status) {
+		// Get the input from the shell console and make it a Command
+		inputString = getInput();
+		Trace_Span parse("parse");
+		Command cmd(std::move(inputString));
+		parse.end();
+		if (cmd.numTokens == 0) continue;
+
+		// Built-ins succeed unless they fail below, programs run in the foreground set their own
+		// status. byebye, also given at the end of input, leaves with the status before it
+		if (cmd.commandNum != byebye_sym)
+			last_status = 0;
+
+		// If help entered, list commands and continue loop
+		if (getHelp(cmd)) continue;
+		
+		// If the command is valid, execute it
+        bool validCmd = executeCommand(cmd);
+		
+		// Add to history if command is not byebye or a history clear, and not from a script
+        if (cmd.validCmd() && cmd.commandNum != byebye_sym && validCmd) {
+			if (input.interactive && (!cmd.hasArgs() || cmd.commandNum != history_sym || !cmd.argsIs("-c")))
+				history.push(cmd.cmdInput);
+		}
+        else if (cmd.commandNum == byebye_sym) // status is now 0
+            break;
+        else {								   // the command input is not recognized
+			last_status = (cmd.commandNum < 0) ? 127 : 2;
+			cout << OUT_INDENT << "Invalid command: "<< cmd.cmdInput << '\n';
+		}
+    }
+}
+
+
+// Execute a given command from the shell based on its command number
+// Input: const Command& cmd - The Command to execute
+// Output: bool - True: Command was executed successfully
+bool executeCommand(const Command& cmd) {
+	// If command not valid, do not try to execute
+	if (!cmd.validCmd()) return false;
+
+	path_cache.beginCommand();
+
+	Trace_Span span(BUILTINS[cmd.commandNum].name);
+	return BUILTINS[cmd.commandNum].handler(cmd);
+}
+
+// Move to given directory
+bool runMoveToDir(const Command& cmd) {
+	moveToDir(cmd);
+	return true;
+}
+
+// Print out current directory
+bool runWhereami(const Command&) {
+	whereami();
+	return true;
+}
+
+// Print out the current history stack, or clear it with -c
+bool runHistory(const Command& cmd) {
+	if (cmd.numTokens == 1)
+		history.printHistory();
+	else if (cmd.argsIs("-c"))
+		history.clearHistory();
+	else
+		return false;
+	return true;
+}
+
+// Set status to 0 and leave program
+bool runByebye(const Command&) {
+	status = 0;
+	return true;
+}
+
+// Replay a given Command from the history stack
+bool runReplay(const Command& cmd) {
+	executeCommand(history.findReplayNum(cmd));
+	return true;
+}
+
+// Start a program (with arguments), wait until it finishes
+bool runStart(const Command& cmd) {
+	start(cmd);
+	return true;
+}
+
+// Start a program (with arguments), do not wait for it to finish
+bool runBackground(const Command& cmd) {
+	background(cmd);
+	return true;
+}
+
+// End a process based on its pid
+bool runDalek(const Command& cmd) {
+	dalek(cmd);
+	return true;
+}
+
+// Repeat a given command a given number of times
+bool runRepeat(const Command& cmd) {
+	repeat(cmd);
+	return true;
+}
+
+// End all processes currently running in shell, with --timeout waiting for them
+bool runDalekall(const Command& cmd) {
+	double timeout;
+	if (!cmd.hasArgs())
+		dalekall();
+	else if (cmd.argsIs("--timeout") && cmd.args.size() == 2 && parseDuration(cmd.args[1], &timeout))
+		dalekallWait(timeout);
+	else
+		return false;
+	return true;
+}
+
+// List running and recently finished processes
+bool runJobs(const Command&) {
+	listJobs();
+	return true;
+}
+
+// Forget the cached locations of programs
+bool runRehash(const Command&) {
+	long long lookups = path_cache.hits + path_cache.misses;
+	cout << OUT_INDENT << "Forgot " << path_cache.clear() << " cached paths ("
+		<< path_cache.hits << " hits in " << lookups << " lookups)" << '\n';
+	return true;
+}
+
+// Show resources used by processes started by the shell
+bool runStats(const Command& cmd) {
+	showStats(cmd);
+	return true;
+}
+
+// Time a command run a number of times
+bool runBench(const Command& cmd) {
+	bench(cmd);
+	return true;
+}
+
+// Continue a job and wait for it
+bool runFg(const Command& cmd) {
+	resumeJob(cmd, true);
+	return true;
+}
+
+// Continue a stopped job without waiting for it
+bool runBg(const Command& cmd) {
+	resumeJob(cmd, false);
+	return true;
+}
+
+// Run the jobs of a graph file in dependency order
+bool runRun(const Command& cmd) {
+	runGraph(cmd);
+	return true;
+}
+
+// Repeat creating a background process a given number of times
+// With -j N at most N of the processes run at once, the rest are queued
+// and started as soon as a running one exits. The placement options of
+// background apply to every process. In the arguments, {i} is replaced by
+// the index of the process, counting from 0, and {n} by COUNT
+// Input: const Command& cmd - Command to repeat
+void repeat(const Command& cmd) {
+	int numArgs = cmd.args.size();
+	int argIdx = 0, nTimes, limit = 0;
+
+	// Get the concurrency limit, if given
+	if (cmd.args[0] == "-j") {
+		if (numArgs < 4 || !parseCount(cmd.args[1], &limit) || limit < 1) {
+			cout << OUT_INDENT << "Invalid Command: " << cmd.cmdInput << '\n';
+			return;
+		}
+		argIdx = 2;
+	}
+
+	// Placement options apply to every process
+	Spawn_Options opts;
+	if (!parseSpawnOptions(cmd, &argIdx, &opts))
+		return;
+
+	if (!parseCount(cmd.args[argIdx], &nTimes)) {
+		cout << OUT_INDENT << "Invalid Command: " << cmd.cmdInput << '\n';
+		return;
+	}
+	argIdx++;
+	
+	// The tokens after the count are the program and its arguments. The
+	// argument array is built once, and each process only fills in {i}
+	if (argIdx >= numArgs) {
+		cout << OUT_INDENT << "Invalid Command: " << cmd.cmdInput << '\n';
+		return;
+	}
+	for (int i = argIdx; i < numArgs; i++) {
+		if (cmd.kind(i + 1) != token_word) {
+			cout << OUT_INDENT << "repeat only applies to a single program without | or redirections" << '\n';
+			return;
+		}
+	}
+	Arg_Template shards(cmd.execArgs() + argIdx, nTimes);
+
+	if (limit == 0) {
+		for (int i = 0; i < nTimes; i++) {
+			char** argv = shards.fill(i);
+			if (launchBackground(argv, shards.line(), opts) < 0)
+				break;
+		}
+		return;
+	}
+
+	// Fill every open slot, then wait for a child to exit before starting more
+	Spawn_Scheduler scheduler(limit);
+	int launched = 0;
+	while (launched < nTimes || scheduler.size() > 0) {
+		while (launched < nTimes && scheduler.hasSlot()) {
+			char** argv = shards.fill(launched);
+			pid_t pid = launchBackground(argv, shards.line(), opts);
+			if (pid < 0) {
+				nTimes = launched; // stop queueing once spawning fails
+				break;
+			}
+			launched++;
+			if (!scheduler.add(pid))
+				break; // untracked child, wait on the rest before starting more
+		}
+
+		if (!scheduler.waitForSlot().empty())
+			reapChildren();
+	}
+}
+
+// Run the jobs of a graph file, each once every job it comes after has succeeded
+// Each line of the file is job NAME [after NAME...]: COMMAND, where COMMAND is
+// anything background accepts. Up to N jobs run at once, N being the number of
+// CPUs unless -j is given. When a job fails, the jobs after it are skipped
+// Input: const Command& cmd - the run Command
+void runGraph(const Command& cmd) {
+	const char* file = NULL;
+	int limit = sysconf(_SC_NPROCESSORS_ONLN);
+	for (int i = 0; i < (int)cmd.args.size(); i++) {
+		if (cmd.args[i] == "-j" && i + 1 < (int)cmd.args.size()) {
+			if (!parseCount(cmd.args[++i], &limit) || limit < 1) {
+				cout << OUT_INDENT << "Invalid Command: " << cmd.cmdInput << '\n';
+				return;
+			}
+		} else if (file == NULL) {
+			file = cmd.execArgs()[i];
+		} else {
+			cout << OUT_INDENT << "Invalid Command: " << cmd.cmdInput << '\n';
+			return;
+		}
+	}
+	if (file == NULL) {
+		cout << OUT_INDENT << "Invalid Command: " << cmd.cmdInput << '\n';
+		return;
+	}
+
+	vector<Graph_Job> graph;
+	if (!loadGraph(file, &graph) || !checkGraph(graph))
+		return;
+
+	struct timespec began, now;
+	clock_gettime(CLOCK_MONOTONIC, &began);
+
+	// Jobs whose dependencies have all succeeded, in file order
+	deque<int> ready;
+	for (int i = 0; i < (int)graph.size(); i++) {
+		if (graph[i].waiting == 0)
+			ready.push_back(i);
+	}
+
+	vector<int> running;
+	int seen = reaper.interrupts;
+	bool interrupted = false;
+	while (!ready.empty() || !running.empty()) {
+		while (!ready.empty() && (int)running.size() < limit && !interrupted) {
+			Graph_Job& job = graph[ready.front()];
+			ready.pop_front();
+			job.pid = background(Command("background --quiet " + job.cmdLine));
+			if (job.pid < 0) {
+				job.state = graph_failed;
+				skipAfter(graph, job);
+				continue;
+			}
+			job.state = graph_running;
+			running.push_back(&job - graph.data());
+			cout << OUT_INDENT << "[" << job.name << "] PID: " << job.pid << '\n';
+		}
+		if (running.empty())
+			break;
+
+		// The reaper's signalfd becomes readable once a child exits, or on SIGINT
+		cout.flush();
+		struct pollfd pfd = {reaper.fd, POLLIN, 0};
+		while (poll(&pfd, 1, -1) < 0 && errno == EINTR) {}
+		reapChildren();
+
+		if (reaper.interrupts != seen && !interrupted) {
+			interrupted = true;
+			cout << OUT_INDENT << "Interrupted, terminating " << running.size() << " jobs" << '\n';
+			for (int i: running) {
+				Job* job = jobs.find(graph[i].pid);
+				if (job != NULL)
+					kill(-job->pgid, SIGTERM);
+			}
+		}
+
+		// A job is finished once the reaper has moved it out of the job table
+		for (int r = running.size() - 1; r >= 0; r--) {
+			Graph_Job& job = graph[running[r]];
+			if (jobs.find(job.pid) != NULL) continue;
+			running[r] = running.back();
+			running.pop_back();
+
+			job.status = -1;
+			for (int i = finished_jobs.size() - 1; i >= 0; i--) {
+				const Job& done = finished_jobs[i];
+				if (done.pid == job.pid) {
+					job.status = done.status;
+					job.seconds = (done.ended.tv_sec - done.started.tv_sec) + (done.ended.tv_nsec - done.started.tv_nsec) / 1e9;
+					break;
+				}
+			}
+
+			int code = (job.status < 0) ? -1 : WIFSIGNALED(job.status) ? 128 + WTERMSIG(job.status) : WEXITSTATUS(job.status);
+			job.state = (code == 0) ? graph_done : graph_failed;
+			cout << OUT_INDENT << "[" << job.name << "] " << (code == 0 ? "done" : "failed") << " status=" << code
+				<< " elapsed=" << fixed << setprecision(3) << job.seconds << "s" << '\n';
+			if (code != 0) {
+				skipAfter(graph, job);
+				continue;
+			}
+			for (int next: job.next) {
+				if (--graph[next].waiting == 0 && graph[next].state == graph_pending)
+					ready.push_back(next);
+			}
+		}
+	}
+
+	// The jobs were reported as they finished, so drop the notices for the prompt
+	job_notices.erase(remove_if(job_notices.begin(), job_notices.end(), [&](const string& notice) {
+		for (const Graph_Job& job: graph) {
+			if (job.pid > 0 && notice.compare(0, to_string(job.pid).size() + 2, "[" + to_string(job.pid) + "]") == 0)
+				return true;
+		}
+		return false;
+	}), job_notices.end());
+
+	int counts[5] = {};
+	for (Graph_Job& job: graph) {
+		if (job.state == graph_pending)
+			job.state = graph_skipped;	// never became ready, because of an interrupt
+		counts[job.state]++;
+	}
+	clock_gettime(CLOCK_MONOTONIC, &now);
+	double elapsed = (now.tv_sec - began.tv_sec) + (now.tv_nsec - began.tv_nsec) / 1e9;
+	cout << OUT_INDENT << graph.size() << " jobs: " << counts[graph_done] << " done, " << counts[graph_failed]
+		<< " failed, " << counts[graph_skipped] << " skipped in " << fixed << setprecision(3) << elapsed << " s" << '\n';
+	for (const Graph_Job& job: graph) {
+		if (job.state == graph_skipped)
+			cout << OUT_INDENT << "Skipped: " << job.name << '\n';
+	}
+}
+
+// Read the jobs of a graph file and connect each to the jobs it comes after
+// Input: const char* path - the file, vector<Graph_Job>* graph - filled with the jobs in file order
+// Output: bool - True: every line was a valid job
+bool loadGraph(const char* path, vector<Graph_Job>* graph) {
+	ifstream in(path);
+	if (!in) {
+		cout << OUT_INDENT << "Could not open graph: " << path << '\n';
+		return false;
+	}
+
+	unordered_map<string, int> names;
+	vector<vector<string>> after;
+	string line;
+	for (int lineNum = 1; getline(in, line); lineNum++) {
+		size_t start = line.find_first_not_of(" \t");
+		if (start == string::npos || line[start] == '#') continue;
+
+		// job NAME [after NAME...]: COMMAND
+		size_t colon = line.find(':');
+		istringstream header(line.substr(0, colon));
+		string word, name;
+		vector<string> deps;
+		bool valid = colon != string::npos && (header >> word) && word == "job" && (header >> name);
+		if (valid && (header >> word)) {
+			valid = word == "after";
+			while (header >> word)
+				deps.push_back(word);
+			valid = valid && !deps.empty();
+		}
+		string cmdLine = valid ? line.substr(colon + 1) : "";
+		size_t cmdStart = cmdLine.find_first_not_of(" \t");
+		if (!valid || cmdStart == string::npos) {
+			cout << OUT_INDENT << path << ":" << lineNum << ": expected job NAME [after NAME...]: COMMAND" << '\n';
+			return false;
+		}
+		if (!names.emplace(name, graph->size()).second) {
+			cout << OUT_INDENT << path << ":" << lineNum << ": job " << name << " is defined twice" << '\n';
+			return false;
+		}
+
+		Graph_Job job;
+		job.name = name;
+		job.cmdLine = cmdLine.substr(cmdStart);
+		job.lineNum = lineNum;
+		graph->push_back(std::move(job));
+		after.push_back(std::move(deps));
+	}
+
+	for (int i = 0; i < (int)graph->size(); i++) {
+		Graph_Job& job = (*graph)[i];
+		for (const string& dep: after[i]) {
+			unordered_map<string, int>::iterator it = names.find(dep);
+			if (it == names.end()) {
+				cout << OUT_INDENT << path << ":" << job.lineNum << ": job " << job.name << " comes after unknown job " << dep << '\n';
+				return false;
+			}
+			job.after.push_back(it->second);
+			(*graph)[it->second].next.push_back(i);
+		}
+		job.waiting = job.after.size();
+	}
+	return true;
+}
+
+// Check that the jobs of a graph can run in some order, that is, that no job
+// comes after itself, directly or through other jobs
+// Input: const vector<Graph_Job>& graph - the jobs
+// Output: bool - True: there is no cycle
+bool checkGraph(const vector<Graph_Job>& graph) {
+	// Remove jobs with nothing left to wait for, until none are left
+	vector<int> waiting(graph.size());
+	vector<int> free;
+	for (int i = 0; i < (int)graph.size(); i++) {
+		waiting[i] = graph[i].after.size();
+		if (waiting[i] == 0) free.push_back(i);
+	}
+	int ordered = 0;
+	while (!free.empty()) {
+		int i = free.back();
+		free.pop_back();
+		ordered++;
+		for (int next: graph[i].next) {
+			if (--waiting[next] == 0) free.push_back(next);
+		}
+	}
+	if (ordered == (int)graph.size()) return true;
+
+	// Every job left waits on another job left, so following those leads around a cycle
+	int i = 0;
+	while (waiting[i] == 0) i++;
+	vector<int> visit(graph.size(), -1);
+	vector<int> path;
+	while (visit[i] < 0) {
+		visit[i] = path.size();
+		path.push_back(i);
+		for (int dep: graph[i].after) {
+			if (waiting[dep] > 0) {
+				i = dep;
+				break;
+			}
+		}
+	}
+
+	cout << OUT_INDENT << "Dependency cycle:";
+	for (int p = path.size() - 1; p >= visit[i]; p--)
+		cout << " " << graph[path[p]].name << " ->";
+	cout << " " << graph[path.back()].name << '\n';
+	return false;
+}
+
+// Skip every job that comes after a failed job, directly or through other jobs
+// Input: vector<Graph_Job>& graph - the jobs, const Graph_Job& failed - the failed job
+void skipAfter(vector<Graph_Job>& graph, const Graph_Job& failed) {
+	vector<int> stack(failed.next);
+	while (!stack.empty()) {
+		Graph_Job& job = graph[stack.back()];
+		stack.pop_back();
+		if (job.state != graph_pending) continue;
+		job.state = graph_skipped;
+		stack.insert(stack.end(), job.next.begin(), job.next.end());
+	}
+}
+
+// Terminate a process
+// Input: const Command& cmd - The current Command
+void dalek(const Command& cmd) {
+	int pidToKill;
+
+	// Only send the signal to processes started by this shell
+	if (!parseCount(cmd.args[0], &pidToKill) || jobs.find(pidToKill) == NULL) {
+		cout << OUT_INDENT << "Could not terminate PID: " << cmd.args[0] << '\n';
+		return;
+	}
+
+	// Send signal to terminate process, the reaper removes it once it exits
+	if (kill(pidToKill, SIGTERM) < 0)
+		cout << OUT_INDENT << "Could not terminate PID: " << pidToKill << '\n';
+}
+
+// Terminate all child processes currently running
+// They stay in the job table until the reaper collects them
+void dalekall() {
+	int size = jobs.size();
+
+	// Stopped jobs only act on the signal once continued
+	for (Job& job: jobs) {
+		kill(job.pid, SIGTERM);
+		if (job.state == job_stopped)
+			kill(job.pid, SIGCONT);
+	}
+
+	cout << OUT_INDENT << "Exterminating " << size << " processes:";
+	for (Job& job: jobs)
+		cout << " " << job.pid;
+	cout << '\n';
+}
+
+// Reap every child that has exited, removing it from the running children
+// and recording its exit status and resource usage
+void reapChildren() {
+	for (const Child_Exit& ex: reaper.reap())
+		recordExit(ex);
+}
+
+// Move an exited child from the job table to the finished jobs, or note
+// that a job stopped or continued
+// Input: const Child_Exit& ex - the exited child
+void recordExit(const Child_Exit& ex) {
+	if (WIFSTOPPED(ex.status) || WIFCONTINUED(ex.status)) {
+		Job* stopped = jobs.find(ex.pid);
+		if (stopped != NULL)
+			stopped->state = WIFSTOPPED(ex.status) ? job_stopped : job_running;
+		return;
+	}
+
+	Job job;
+	if (!jobs.remove(ex.pid, &job)) return;
+
+	dropCachedFiles(job);
+	job.state = job_done;
+	job.status = ex.status;
+	job.usage = ex.usage;
+	clock_gettime(CLOCK_MONOTONIC, &job.ended);
+
+	metrics.jobsDone++;
+	metrics.wallSeconds += (job.ended.tv_sec - job.started.tv_sec) + (job.ended.tv_nsec - job.started.tv_nsec) / 1e9;
+	metrics.userSeconds += toSeconds(ex.usage.ru_utime);
+	metrics.sysSeconds += toSeconds(ex.usage.ru_stime);
+	metrics.maxRssKb = max(metrics.maxRssKb, ex.usage.ru_maxrss);
+	metrics.minorFaults += ex.usage.ru_minflt;
+	metrics.majorFaults += ex.usage.ru_majflt;
+	metrics.voluntarySwitches += ex.usage.ru_nvcsw;
+	metrics.involuntarySwitches += ex.usage.ru_nivcsw;
+
+	if (!job.foreground && input.interactive) {
+		double elapsed = (job.ended.tv_sec - job.started.tv_sec) + (job.ended.tv_nsec - job.started.tv_nsec) / 1e9;
+		int code = WIFSIGNALED(job.status) ? 128 + WTERMSIG(job.status) : WEXITSTATUS(job.status);
+		ostringstream notice;
+		notice << "[" << job.pid << "] done status=" << code << " elapsed=" << fixed << setprecision(3) << elapsed << "s";
+		job_notices.push_back(notice.str());
+	}
+
+	finished_jobs.push_back(std::move(job));
+	if (!finished_jobs.back().foreground)
+		unreported_jobs++;
+
+	if (finished_jobs.size() > EXIT_LOG_MAX) {
+		finished_jobs.pop_front();
+		unreported_jobs = min(unreported_jobs, (int)finished_jobs.size());
+	}
+}
+
+// Print the running jobs and the background jobs that finished since the last listing
+void listJobs() {
+	struct timespec now;
+	clock_gettime(CLOCK_MONOTONIC, &now);
+
+	if (jobs.size() == 0 && unreported_jobs == 0) return;
+	cout << OUT_INDENT << "Jobs:" << '\n';
+
+	for (Job& job: jobs) {
+		double elapsed = (now.tv_sec - job.started.tv_sec) + (now.tv_nsec - job.started.tv_nsec) / 1e9;
+		cout << OUT_INDENT << job.pid << (job.state == job_stopped ? "  Stopped   " : "  Running   ") << fixed << setprecision(1) << elapsed
+			<< "s  " << job.cmdLine << '\n';
+	}
+
+	// Foreground jobs are interleaved with the background ones, so step back over them
+	int first = finished_jobs.size();
+	for (int left = unreported_jobs; left > 0 && first > 0; ) {
+		if (!finished_jobs[--first].foreground)
+			left--;
+	}
+
+	for (int i = first; i < (int)finished_jobs.size(); i++) {
+		Job& job = finished_jobs[i];
+		if (job.foreground) continue;
+
+		double elapsed = (job.ended.tv_sec - job.started.tv_sec) + (job.ended.tv_nsec - job.started.tv_nsec) / 1e9;
+		cout << OUT_INDENT << job.pid << "  ";
+		if (WIFSIGNALED(job.status))
+			cout << "Killed(" << WTERMSIG(job.status) << ")";
+		else
+			cout << "Done(" << WEXITSTATUS(job.status) << ")  ";
+		cout << " " << fixed << setprecision(1) << elapsed << "s  " << job.cmdLine << '\n';
+	}
+	cout.unsetf(ios::floatfield);
+	unreported_jobs = 0;
+}
+
+// Wait for the processes of a foreground job, collecting any other children that exit meanwhile
+// At a terminal the job has its own process group and is handed the terminal
+// until it exits or stops, so Ctrl-C and Ctrl-Z reach only the job. Otherwise
+// it shares the shell's group, and a SIGINT sent to the shell with kill is
+// passed on to the job
+// Input: const vector<pid_t>& pids - the processes to wait for
+void waitForeground(const vector<pid_t>& pids) {
+	Trace_Span span("wait");
+	cout.flush();
+	struct pollfd pfd = {reaper.fd, POLLIN, 0};
+	int seen = reaper.interrupts;
+	bool interrupted = false;
+	if (pids.empty()) {
+		last_status = 127; // nothing could be started
+		return;
+	}
+
+	Job* leader = jobs.find(pids[0]);
+	pid_t pgid = (leader != NULL) ? leader->pgid : shell_pgid;
+	giveTerminal(pgid);
+
+	while (true) {
+		bool running = false;
+		for (pid_t pid: pids) {
+			Job* job = jobs.find(pid);
+			running = running || (job != NULL && job->state != job_stopped);
+		}
+		if (!running) break;
+
+		if (poll(&pfd, 1, -1) < 0 && errno != EINTR)
+			break;
+
+		for (const Child_Exit& ex: reaper.reap()) {
+			bool ours = find(pids.begin(), pids.end(), ex.pid) != pids.end();
+			if (ours && WIFSIGNALED(ex.status) && WTERMSIG(ex.status) == SIGINT)
+				interrupted = true;
+			recordExit(ex);
+
+			// Stopped for touching the terminal before it was handed over
+			if (ours && WIFSTOPPED(ex.status) && (WSTOPSIG(ex.status) == SIGTTIN || WSTOPSIG(ex.status) == SIGTTOU)
+					&& pgid != shell_pgid) {
+				jobs.find(ex.pid)->state = job_running;
+				kill(-pgid, SIGCONT);
+			}
+		}
+
+		if (reaper.interrupts != seen && !reaper.interruptTyped && pgid == shell_pgid) {
+			for (pid_t pid: pids)
+				if (jobs.find(pid) != NULL)
+					kill(pid, SIGINT);
+		}
+		interrupted = interrupted || (reaper.interrupts != seen && pgid == shell_pgid);
+		seen = reaper.interrupts;
+	}
+
+	giveTerminal(shell_pgid);
+
+	// The status of a pipeline is that of its last stage
+	for (int i = finished_jobs.size() - 1; i >= 0; i--) {
+		if (finished_jobs[i].pid == pids.back()) {
+			last_status = exitCode(finished_jobs[i].status);
+			break;
+		}
+	}
+
+	// A stopped job is left in the job table, to be continued with fg or bg
+	string cmdLine;
+	for (pid_t pid: pids) {
+		Job* job = jobs.find(pid);
+		if (job == NULL) continue;
+		job->foreground = false;
+		cmdLine += (cmdLine.empty() ? "" : " | ") + job->cmdLine;
+	}
+	if (!cmdLine.empty()) {
+		last_status = 128 + SIGTSTP;
+		cout << '\n' << OUT_INDENT << "[" << pgid << "] Stopped  " << cmdLine << '\n';
+	}
+
+	// Start the prompt on a fresh line after the ^C echoed by the terminal
+	else if (interrupted && input.interactive)
+		cout << '\n';
+}
+
+// Get the exit code of a process the way sh reports it
+// Input: int status - status as returned by wait4
+// Output: the exit code, or 128 + N if signal N ended the process
+int exitCode(int status) {
+	return WIFSIGNALED(status) ? 128 + WTERMSIG(status) : WEXITSTATUS(status);
+}
+
+// Test if a job was started before another
+// Input: const Job& a, const Job& b - the jobs
+// Output: bool - True: a was started first
+bool startedBefore(const Job& a, const Job& b) {
+	if (a.started.tv_sec != b.started.tv_sec)
+		return a.started.tv_sec < b.started.tv_sec;
+	return a.started.tv_nsec < b.started.tv_nsec;
+}
+
+// Make the shell the foreground process group of its terminal, and ignore
+// the signals the terminal sends to stop jobs, so only the jobs stop
+void initJobControl() {
+	// Wait until started in the foreground
+	while (tcgetpgrp(STDIN_FILENO) != getpgrp())
+		kill(-getpgrp(), SIGTTIN);
+
+	signal(SIGTSTP, SIG_IGN);
+	signal(SIGTTIN, SIG_IGN);
+	signal(SIGTTOU, SIG_IGN);
+
+	// A session leader already leads its own group
+	setpgid(0, 0);
+	shell_pgid = getpgrp();
+	tcsetpgrp(STDIN_FILENO, shell_pgid);
+	tcgetattr(STDIN_FILENO, &shell_tmodes);
+}
+
+// Hand the terminal to a process group; back to the shell, restoring the modes
+// of the prompt in case a job changed them
+// Input: pid_t pgid - the process group
+void giveTerminal(pid_t pgid) {
+	if (!input.interactive) return;
+
+	tcsetpgrp(STDIN_FILENO, pgid);
+	if (pgid == shell_pgid)
+		tcsetattr(STDIN_FILENO, TCSADRAIN, &shell_tmodes);
+}
+
+// Undo the signal state of the shell in a forked child: the blocked SIGCHLD and
+// SIGINT, and the ignored job control signals. Only async-signal-safe calls
+void resetChildSignals() {
+	sigset_t empty;
+	sigemptyset(&empty);
+	sigprocmask(SIG_SETMASK, &empty, NULL);
+
+	struct sigaction dfl = {};
+	dfl.sa_handler = SIG_DFL;
+	sigaction(SIGTSTP, &dfl, NULL);
+	sigaction(SIGTTIN, &dfl, NULL);
+	sigaction(SIGTTOU, &dfl, NULL);
+}
+
+// Continue a job in its process group, and with fg wait for it. Without a pid,
+// the most recently started job that is stopped, or for fg running in the background
+// Input: const Command& cmd - Command containing fg or bg, bool foreground - True: fg
+void resumeJob(const Command& cmd, bool foreground) {
+	Job* target = NULL;
+	if (cmd.hasArgs()) {
+		int pid;
+		if (!parseCount(cmd.args[0], &pid) || (target = jobs.find(pid)) == NULL || target->foreground) {
+			cout << OUT_INDENT << "No such job: " << cmd.args[0] << '\n';
+			return;
+		}
+	}
+	else {
+		// Stopped jobs come before running ones, then the newest
+		for (Job& job: jobs) {
+			if (job.foreground || (!foreground && job.state != job_stopped))
+				continue;
+			if (target == NULL || (job.state == job_stopped && target->state != job_stopped)
+					|| ((job.state == job_stopped) == (target->state == job_stopped) && startedBefore(*target, job)))
+				target = &job;
+		}
+		if (target == NULL) {
+			cout << OUT_INDENT << "No " << (foreground ? "background" : "stopped") << " jobs" << '\n';
+			return;
+		}
+	}
+
+	// Every stage of a pipeline, first stage first
+	pid_t pgid = target->pgid;
+	vector<Job*> stages;
+	for (Job& job: jobs)
+		if (job.pgid == pgid)
+			stages.push_back(&job);
+	sort(stages.begin(), stages.end(), [](const Job* a, const Job* b) { return startedBefore(*a, *b); });
+
+	vector<pid_t> pids;
+	string cmdLine;
+	for (Job* job: stages) {
+		job->foreground = foreground;
+		job->state = job_running;
+		pids.push_back(job->pid);
+		cmdLine += (cmdLine.empty() ? "" : " | ") + job->cmdLine;
+	}
+
+	cout << OUT_INDENT << "[" << pgid << "] " << cmdLine << (foreground ? "" : " &") << '\n';
+	if (foreground)
+		giveTerminal(pgid);
+	if (kill(-pgid, SIGCONT) < 0) {
+		cout << OUT_INDENT << "Could not continue: " << strerror(errno) << '\n';
+		giveTerminal(shell_pgid);
+		return;
+	}
+	if (foreground)
+		waitForeground(pids);
+}
+
+// Show the resources used by finished processes: each recent one, one given
+// by pid, or with --summary the totals over every process and the shell itself
+// Input: const Command& cmd - Command containing stats
+void showStats(const Command& cmd) {
+	if (!cmd.hasArgs()) {
+		if (finished_jobs.empty()) return;
+		cout << OUT_INDENT << STATS_HEADER << '\n';
+		for (const Job& job: finished_jobs)
+			printUsage(job);
+		cout.unsetf(ios::floatfield);
+		return;
+	}
+
+	if (cmd.argsIs("--summary")) {
+		struct rusage self;
+		getrusage(RUSAGE_SELF, &self);
+		long long lookups = path_cache.hits + path_cache.misses;
+
+		cout << fixed << setprecision(3);
+		cout << OUT_INDENT << "Processes reaped:   " << metrics.jobsDone << '\n';
+		cout << OUT_INDENT << "Wall time:          " << metrics.wallSeconds << " s" << '\n';
+		cout << OUT_INDENT << "User CPU:           " << metrics.userSeconds << " s" << '\n';
+		cout << OUT_INDENT << "System CPU:         " << metrics.sysSeconds << " s" << '\n';
+		cout << OUT_INDENT << "Largest max RSS:    " << metrics.maxRssKb << " KB" << '\n';
+		cout << OUT_INDENT << "Page faults:        " << metrics.minorFaults << " minor, " << metrics.majorFaults << " major" << '\n';
+		cout << OUT_INDENT << "Context switches:   " << metrics.voluntarySwitches << " voluntary, "
+			<< metrics.involuntarySwitches << " involuntary" << '\n';
+		cout << OUT_INDENT << "Shell CPU:          " << toSeconds(self.ru_utime) << " s user, "
+			<< toSeconds(self.ru_stime) << " s system, " << self.ru_maxrss << " KB max RSS" << '\n';
+		cout << OUT_INDENT << "Path cache:         " << path_cache.hits << " hits in " << lookups << " lookups";
+		if (lookups > 0)
+			cout << " (" << setprecision(1) << 100.0 * path_cache.hits / lookups << "%)";
+		cout << '\n';
+		cout << OUT_INDENT << "Result cache:       " << result_cache.hits << " hits, " << result_cache.misses << " misses" << '\n';
+		if (metrics.firstPromptMs >= 0)
+			cout << OUT_INDENT << "First prompt after: " << setprecision(3) << metrics.firstPromptMs << " ms" << '\n';
+		cout.unsetf(ios::floatfield);
+		return;
+	}
+
+	int pid;
+	if (!parseCount(cmd.args[0], &pid)) {
+		cout << OUT_INDENT << "Invalid Command: " << cmd.cmdInput << '\n';
+		return;
+	}
+
+	if (jobs.find(pid) != NULL) {
+		cout << OUT_INDENT << "Process " << pid << " is still running" << '\n';
+		return;
+	}
+
+	// The most recent process with the pid, as pids are reused
+	for (int i = finished_jobs.size() - 1; i >= 0; i--) {
+		if (finished_jobs[i].pid == pid) {
+			cout << OUT_INDENT << STATS_HEADER << '\n';
+			printUsage(finished_jobs[i]);
+			cout.unsetf(ios::floatfield);
+			return;
+		}
+	}
+	cout << OUT_INDENT << "No finished process with PID " << pid << '\n';
+}
+
+// Run a command a given number of times through the normal dispatch, timing
+// each run from before the spawn until the shell has reaped the process. With
+// --pipeline, time the shell's own work on a command line instead
+// Input: const Command& cmd - Command containing bench
+void bench(const Command& cmd) {
+	bool pipeline = cmd.argsIs("--pipeline");
+	int n;
+	if (!parseCount(cmd.args[pipeline ? 1 : 0], &n) || n < 1) {
+		cout << OUT_INDENT << "Invalid Command: " << cmd.cmdInput << '\n';
+		return;
+	}
+
+	// Tokens after the count, as a command line of their own
+	string line = cmd.joinFrom(pipeline ? 3 : 2);
+	if (pipeline) {
+		benchPipeline(n, line.empty() ? "start /bin/echo \"hello world\" | tee out.txt > /dev/null" : line);
+		return;
+	}
+
+	Command timed(line);
+	if (!timed.validCmd()) {
+		cout << OUT_INDENT << "Invalid command: " << line << '\n';
+		return;
+	}
+
+	vector<double> us;
+	us.reserve(n);
+	struct timespec begin, before, after;
+	clock_gettime(CLOCK_MONOTONIC, &begin);
+	for (int i = 0; i < n && status; i++) {
+		clock_gettime(CLOCK_MONOTONIC, &before);
+		executeCommand(timed);
+		clock_gettime(CLOCK_MONOTONIC, &after);
+		us.push_back((after.tv_sec - before.tv_sec) * 1e6 + (after.tv_nsec - before.tv_nsec) / 1e3);
+	}
+	printLatencies(us, (after.tv_sec - begin.tv_sec) + (after.tv_nsec - begin.tv_nsec) / 1e9);
+}
+
+// Time the steps the shell takes for every command line: tokenizing it,
+// looking up its built-in and checking its arguments, and adding it to the
+// history. The history is a scratch one, so the history file is not touched
+// Input: int n - number of times to run each step, const string& line - the command line
+void benchPipeline(int n, const string& line) {
+	struct timespec t0, t1, t2, t3;
+	Command cmd(line);
+	Command_Stack scratch;
+	long long checksum = 0;				// Keeps the compiler from dropping the loops
+
+	clock_gettime(CLOCK_MONOTONIC, &t0);
+	for (int i = 0; i < n; i++) {
+		Command c(line);
+		checksum += c.numTokens;
+	}
+	clock_gettime(CLOCK_MONOTONIC, &t1);
+	for (int i = 0; i < n; i++) {
+		checksum += findBuiltin(cmd.command);
+		checksum += cmd.validCmd();
+	}
+	clock_gettime(CLOCK_MONOTONIC, &t2);
+	for (int i = 0; i < n; i++)
+		scratch.store(cmd.cmdInput);
+	clock_gettime(CLOCK_MONOTONIC, &t3);
+
+	const struct timespec* marks[] = {&t0, &t1, &t2, &t3};
+	const char* names[] = {"tokenize:", "dispatch:", "history push:"};
+	cout << OUT_INDENT << n << " runs of: " << line << " (" << cmd.numTokens << " tokens, checksum " << checksum << ")" << '\n';
+	cout << fixed << setprecision(1);
+	for (int i = 0; i < 3; i++) {
+		double ns = ((marks[i + 1]->tv_sec - marks[i]->tv_sec) * 1e9 + (marks[i + 1]->tv_nsec - marks[i]->tv_nsec)) / n;
+		cout << OUT_INDENT << left << setw(14) << names[i] << right << setw(10) << ns << " ns/op  "
+			<< setw(14) << 1e9 / ns << " ops/s" << '\n';
+	}
+	cout.unsetf(ios::floatfield);
+}
+
+// Print the spread of a set of latencies and the rate they were achieved at
+// Input: vector<double>& us - latencies in microseconds, sorted here,
+//		  double seconds - wall time of the whole run
+void printLatencies(vector<double>& us, double seconds) {
+	if (us.empty()) return;
+	sort(us.begin(), us.end());
+
+	// Nearest rank percentiles
+	size_t p50 = (us.size() * 50 + 99) / 100 - 1;
+	size_t p99 = (us.size() * 99 + 99) / 100 - 1;
+
+	cout << fixed << setprecision(1);
+	cout << OUT_INDENT << us.size() << " runs in " << setprecision(3) << seconds << " s, "
+		<< setprecision(1) << us.size() / seconds << " runs/s" << '\n';
+	cout << OUT_INDENT << "min " << us.front() << " us  p50 " << us[p50] << " us  p99 " << us[p99]
+		<< " us  max " << us.back() << " us" << '\n';
+	cout.unsetf(ios::floatfield);
+}
+
+// Print one row of the stats table
+// Input: const Job& job - a finished job
+void printUsage(const Job& job) {
+	double wall = (job.ended.tv_sec - job.started.tv_sec) + (job.ended.tv_nsec - job.started.tv_nsec) / 1e9;
+	int code = WIFSIGNALED(job.status) ? 128 + WTERMSIG(job.status) : WEXITSTATUS(job.status);
+	const struct rusage& u = job.usage;
+
+	cout << OUT_INDENT << left << setw(8) << job.pid << right << " " << setw(6) << code
+		<< fixed << setprecision(3)
+		<< " " << setw(8) << wall << " " << setw(9) << toSeconds(u.ru_utime) << " " << setw(9) << toSeconds(u.ru_stime)
+		<< " " << setw(11) << u.ru_maxrss << " " << setw(7) << u.ru_minflt + u.ru_majflt
+		<< " " << setw(9) << u.ru_nvcsw + u.ru_nivcsw << "  " << job.cmdLine << '\n';
+}
+
+// Convert a timeval to seconds
+// Input: const struct timeval& tv - the time
+// Output: double - the time in seconds
+double toSeconds(const struct timeval& tv) {
+	return tv.tv_sec + tv.tv_usec / 1e6;
+}
+
+// Wait until input is available, reaping children that exit in the meantime
+// Output: bool - False: reading failed and no more input can be read
+bool waitForInput() {
+	struct epoll_event events[3];
+	int seen = reaper.interrupts;
+	cout.flush(); // everything so far is shown before blocking
+
+	while (input.pollable) {
+		int n = epoll_wait(events_fd, events, 3, -1);
+		if (n < 0) {
+			if (errno == EINTR) continue;
+			return false;
+		}
+
+		bool inputReady = false;
+		for (int i = 0; i < n; i++) {
+			if (events[i].data.fd == reaper.fd)
+				reapChildren();
+			else if (events[i].data.fd == completer.fd)
+				completer.readEvents();
+			else
+				inputReady = true;
+		}
+
+		// Ctrl-C at the prompt discards the line typed so far, or ends a script
+		if (reaper.interrupts != seen) {
+			if (!input.interactive) return false;
+			seen = reaper.interrupts;
+			cout << '\n' << "# " << flush;
+		}
+
+		if (inputReady) break;
+	}
+
+	if (!input.pollable)
+		reapChildren();
+
+	return input.fill();
+}
+
+// Start given process in shell. To run program, precede program with ./
+// Wait until it finishes to resume shell. Programs separated by | are run as a
+// pipeline, and the shell waits for every stage
+// Input: const Command& cmd - The current Command
+void start(const Command& cmd) {
+	Spawn_Options opts;
+	int first = 0;
+	bool cached = false;
+	vector<string> inputs;
+	if (cmd.argsIs("--cache")) {
+		cached = true;
+		first = 1;
+		for (; first < (int)cmd.args.size() && cmd.args[first] == "--in"; first += 2) {
+			if (first + 1 >= (int)cmd.args.size()) {
+				cout << OUT_INDENT << "Expected a file after --in" << '\n';
+				return;
+			}
+			inputs.emplace_back(cmd.args[first + 1]);
+		}
+	}
+	if (!parseSpawnOptions(cmd, &first, &opts))
+		return;
+	if (opts.placed()) {
+		cout << OUT_INDENT << "--cpus, --numa and --cgroup only apply to background jobs" << '\n';
+		return;
+	}
+
+	Trace_Span split("pipeline");
+	Pipeline pipeline(cmd, first);
+	split.end();
+	if (!pipeline.valid()) {
+		cout << OUT_INDENT << "Invalid Command: " << pipeline.error << '\n';
+		return;
+	}
+
+	char** args = pipeline.stages[0];
+	string programPath;
+
+	// If multiple args, assume local directory
+	// If one relative arg, add the working directory for absolute path name
+	if (pipeline.stages.size() == 1 && args[1] == NULL && args[0][0] != '/')
+		programPath = work_dir.path + args[0];
+	else
+		programPath = args[0];
+
+	if (cached) {
+		if (pipeline.stages.size() != 1 || !pipeline.redirects[0].empty()) {
+			cout << OUT_INDENT << "--cache only applies to a single program without redirections" << '\n';
+			return;
+		}
+		if (startCached(args, programPath, inputs, opts))
+			return;
+	}
+
+	// Wait until every process of the pipeline is completed
+	waitForeground(launchPipeline(pipeline, opts, programPath.c_str(), true));
+}
+
+// Run a program in the foreground unless the same run is in the result cache, in which
+// case write its stored output instead. A run is the same when its arguments, the
+// working directory, and the program file and input files (by inode, size and mtime)
+// are. Output is kept only for runs that exit normally, along with their exit status,
+// which a replay restores as the status of the command
+// Input: char** args - program and arguments, const string& programPath - the program file,
+//        const vector<string>& inputs - files the program reads, const Spawn_Options& opts - as for start
+// Output: bool - False: the cache could not be used, so run the program as usual
+bool startCached(char** args, const string& programPath, const vector<string>& inputs, const Spawn_Options& opts) {
+	Trace_Span lookup("cache_lookup");
+	if (!result_cache.open())
+		return false;
+	const char* path = path_cache.lookup(programPath.c_str());
+	string key = (path != NULL) ? result_cache.key(args, path, work_dir.path, inputs) : "";
+	lookup.end();
+	if (key.empty())
+		return false;
+
+	int code;
+	if (result_cache.replay(key, &code)) {
+		result_cache.hits++;
+		last_status = code;
+		return true;
+	}
+	result_cache.misses++;
+
+	// Run it as PROG ARGS | tee TEMP, so the output streams to the terminal while it is kept
+	string tmpPath = result_cache.tempPath(key);
+	string line = "start";
+	for (int i = 0; args[i] != NULL; i++) {
+		line += ' ';
+		Command::appendWord(line, args[i]);
+	}
+	line += " | tee ";
+	Command::appendWord(line, tmpPath);
+	Command teed(line);
+	Pipeline pipeline(teed, 0);
+	vector<pid_t> pids = launchPipeline(pipeline, opts, path, true);
+	waitForeground(pids);
+	if (pids.size() != 2 || jobs.find(pids[0]) != NULL || jobs.find(pids[1]) != NULL) {
+		// Not started, or stopped and still running
+		unlink(tmpPath.c_str());
+		return true;
+	}
+
+	int statuses[2] = {-1, -1};
+	for (int i = finished_jobs.size() - 1, found = 0; i >= 0 && found < 2; i--) {
+		for (int s = 0; s < 2; s++) {
+			if (finished_jobs[i].pid == pids[s]) {
+				statuses[s] = finished_jobs[i].status;
+				found++;
+			}
+		}
+	}
+
+	// waitForeground took the status of tee, the last stage, but the run's is the program's
+	if (statuses[0] >= 0)
+		last_status = exitCode(statuses[0]);
+	if (statuses[0] >= 0 && WIFEXITED(statuses[0]) && statuses[1] >= 0 && WIFEXITED(statuses[1]) && WEXITSTATUS(statuses[1]) == 0) {
+		Trace_Span store("cache_store");
+		result_cache.store(key, tmpPath, WEXITSTATUS(statuses[0]));
+	} else {
+		unlink(tmpPath.c_str());
+	}
+	return true;
+}
+
+
+// Start given process in shell. To run program, precede program with ./
+// Do not wait until it finishes to resume shell
+// Input: const Command& cmd - The current Command
+// Output: the pid of the child process (the last stage of a pipeline), or -1 if it could not be started
+int background(const Command& cmd) {
+	Spawn_Options opts;
+	int first = 0;
+	if (!parseSpawnOptions(cmd, &first, &opts))
+		return -1;
+
+	Trace_Span split("pipeline");
+	Pipeline pipeline(cmd, first);
+	split.end();
+	if (!pipeline.valid()) {
+		cout << OUT_INDENT << "Invalid Command: " << pipeline.error << '\n';
+		return -1;
+	}
+
+	if (pipeline.stages.size() == 1 && pipeline.redirects[0].empty()) {
+		char** args = pipeline.stages[0];
+		return launchBackground(args, joinArgs(args), opts);
+	}
+	if (opts.placed()) {
+		cout << OUT_INDENT << "--cpus, --numa and --cgroup only apply to a single program without redirections" << '\n';
+		return -1;
+	}
+
+	vector<pid_t> pids = launchPipeline(pipeline, opts, NULL, false);
+	return pids.empty() ? -1 : pids.back();
+}
+
+// Read the options given before the program of start, background or repeat
+//     --pipesz SIZE  buffer size of each pipe in a pipeline, with an optional K, M or G suffix
+//     --cpus LIST    run only on the given CPUs, such as 0-7,12
+//     --numa NODE    allocate memory only from the given NUMA node
+//     --cgroup NAME  start in the cgroup v2 leaf NAME under $MYSH_CGROUP_ROOT or /sys/fs/cgroup/mysh
+//     --mem SIZE     set memory.max of that cgroup, with an optional K, M or G suffix
+//     --quiet        do not print the PID of each background process
+// Input: const Command& cmd - the Command, int* idx - index in cmd.args to start at,
+//		  set to the index of the program, Spawn_Options* opts - set to the options given
+// Output: bool - False: an option was invalid, and the reason was printed
+bool parseSpawnOptions(const Command& cmd, int* idx, Spawn_Options* opts) {
+	int i = *idx;
+	int numArgs = cmd.args.size();
+
+	while (i < numArgs && cmd.kind(i + 1) == token_word && cmd.args[i].substr(0, 2) == "--") {
+		string_view opt = cmd.args[i];
+		if (!optionTakesValue(opt)) {
+			// --cache is read by start before the other options
+			if (opt != "--quiet") {
+				cout << OUT_INDENT << "Invalid option: " << opt << '\n';
+				return false;
+			}
+			opts->quiet = true;
+			i++;
+			continue;
+		}
+
+		string_view value = (i + 1 < numArgs) ? cmd.args[i + 1] : "";
+		bool valid;
+
+		if (opt == "--pipesz")
+			valid = parseSize(value, &opts->pipeSize);
+		else if (opt == "--cpus")
+			valid = opts->pinned = parseCpuList(value, &opts->cpus);
+		else if (opt == "--numa")
+			valid = parseCount(value, &opts->numaNode);
+		else if (opt == "--mem")
+			valid = parseSize(value, &opts->memMax) && opts->memMax > 0;
+		else if (opt == "--cgroup") {
+			opts->cgroup = value;
+			valid = !value.empty() && value.find('/') == string_view::npos && value != "." && value != "..";
+		}
+		else
+			valid = false;
+
+		if (!valid || i + 1 >= numArgs) {
+			cout << OUT_INDENT << "Invalid option: " << opt << '\n';
+			return false;
+		}
+		i += 2;
+	}
+
+	if (i >= numArgs) {
+		cout << OUT_INDENT << "Invalid Command: " << cmd.cmdInput << '\n';
+		return false;
+	}
+	if (opts->memMax > 0 && opts->cgroup.empty()) {
+		cout << OUT_INDENT << "--mem needs --cgroup" << '\n';
+		return false;
+	}
+	if (!opts->cgroup.empty() && !openCgroup(opts))
+		return false;
+
+	*idx = i;
+	return true;
+}
+
+// Parse a list of CPUs, such as 0-3,8,10-11
+// Input: string_view s - the list, cpu_set_t* cpus - set to the CPUs listed
+// Output: bool - True: s was a valid list
+bool parseCpuList(string_view s, cpu_set_t* cpus) {
+	CPU_ZERO(cpus);
+	while (!s.empty()) {
+		size_t comma = s.find(',');
+		string_view range = s.substr(0, comma);
+		s = (comma == string_view::npos) ? string_view() : s.substr(comma + 1);
+
+		size_t dash = range.find('-');
+		int lo, hi;
+		if (!parseCount(range.substr(0, dash), &lo))
+			return false;
+		if (dash == string_view::npos)
+			hi = lo;
+		else if (!parseCount(range.substr(dash + 1), &hi))
+			return false;
+		if (lo > hi || hi >= CPU_SETSIZE)
+			return false;
+
+		for (int cpu = lo; cpu <= hi; cpu++)
+			CPU_SET(cpu, cpus);
+	}
+	return CPU_COUNT(cpus) > 0;
+}
+
+// Create the cgroup named in the options if needed, set its memory limit and open it
+// Input: Spawn_Options* opts - the options, cgroupFd is set to the open cgroup
+// Output: bool - False: the cgroup could not be set up, and the reason was printed
+bool openCgroup(Spawn_Options* opts) {
+	const char* env = getenv("MYSH_CGROUP_ROOT");
+	string root = (env != NULL && env[0] != '\0') ? env : "/sys/fs/cgroup/mysh";
+	string path = root + "/" + opts->cgroup;
+
+	if ((mkdir(root.c_str(), 0755) < 0 && errno != EEXIST) || (mkdir(path.c_str(), 0755) < 0 && errno != EEXIST)) {
+		cout << OUT_INDENT << "Could not create cgroup " << path << ": " << strerror(errno) << '\n';
+		return false;
+	}
+
+	// Leaves only have a memory.max once the parent hands the memory controller down
+	if (opts->memMax > 0) {
+		int rootFd = ::open(root.c_str(), O_RDONLY | O_DIRECTORY | O_CLOEXEC);
+		if (rootFd >= 0) {
+			writeCgroupFile(rootFd, "cgroup.subtree_control", "+memory");
+			::close(rootFd);
+		}
+	}
+
+	opts->cgroupFd = ::open(path.c_str(), O_RDONLY | O_DIRECTORY | O_CLOEXEC);
+	if (opts->cgroupFd < 0) {
+		cout << OUT_INDENT << "Could not open cgroup " << path << ": " << strerror(errno) << '\n';
+		return false;
+	}
+
+	if (opts->memMax > 0 && !writeCgroupFile(opts->cgroupFd, "memory.max", to_string(opts->memMax))) {
+		cout << OUT_INDENT << "Could not set memory.max of " << path << ": " << strerror(errno) << '\n';
+		return false;
+	}
+	return true;
+}
+
+// Write a value to a file of a cgroup
+// Input: int dirFd - the cgroup directory, const char* name - the file, const string& value - the value
+// Output: bool - True: the value was written, otherwise errno is set
+bool writeCgroupFile(int dirFd, const char* name, const string& value) {
+	int fd = openat(dirFd, name, O_WRONLY | O_CLOEXEC);
+	if (fd < 0) return false;
+
+	bool written = write(fd, value.data(), value.size()) == (ssize_t)value.size();
+	int err = errno;
+	::close(fd);
+	errno = err;
+	return written;
+}
+
+// Start every stage of a pipeline, each connected to the next by a pipe.
+// A stage after the first that runs tee is handled by the shell itself, with
+// tee(2) and splice(2), so the copy to the file never passes through user space
+// Input: Pipeline& pipeline - the stages, const Spawn_Options& opts - the options,
+//		  const char* firstPath - program path of the first stage, or NULL to use its name,
+//		  bool foreground - True: the caller waits for the stages, False: print their PIDs
+// Output: the pid of every stage that was started
+vector<pid_t> launchPipeline(Pipeline& pipeline, const Spawn_Options& opts, const char* firstPath, bool foreground) {
+	vector<pid_t> pids;
+	int numStages = pipeline.stages.size();
+	int prevRead = -1;
+
+	// Background jobs, and at a terminal every job, get a process group of their own
+	bool ownGroup = !foreground || input.interactive;
+
+	// Output of the shell so far comes before the job's
+	if (foreground)
+		cout.flush();
+
+	for (int i = 0; i < numStages; i++) {
+		char** args = pipeline.stages[i];
+		int p[2] = {-1, -1};
+
+		if (i + 1 < numStages) {
+			if (pipe2(p, O_CLOEXEC) < 0) {
+				cout << OUT_INDENT << "Could not create pipe for: " << args[0] << '\n';
+				break;
+			}
+			if (opts.pipeSize > 0 && fcntl(p[1], F_SETPIPE_SZ, (int)opts.pipeSize) < 0)
+				cout << OUT_INDENT << "Could not set pipe size: " << strerror(errno) << '\n';
+		}
+
+		// Open the stage's redirections in the shell so the hints can be applied
+		vector<int> files;
+		bool opened = true;
+		for (const Redirect& r: pipeline.redirects[i]) {
+			int fd = openRedirect(r);
+			if (fd < 0) {
+				opened = false;
+				break;
+			}
+			files.push_back(fd);
+		}
+
+		pid_t c_pid = -1;
+		int err = 0;
+		if (!opened) {
+			err = ENOENT; // already reported by openRedirect
+		}
+		else if (i > 0 && strcmp(args[0], "tee") == 0) {
+			// Built-in tee stage, run in a copy of the shell
+			Trace_Span span("fork_tee");
+			c_pid = fork();
+			if (c_pid == 0) {
+				resetChildSignals();
+				if (ownGroup)
+					setpgid(0, pids.empty() ? 0 : pids[0]);
+
+				dup2(prevRead, STDIN_FILENO);
+				if (p[1] >= 0)
+					dup2(p[1], STDOUT_FILENO);
+				for (size_t r = 0; r < files.size(); r++)
+					dup2(files[r], pipeline.redirects[i][r].fd);
+
+				// Nothing is exec'd, so close-on-exec never applies. Close the rest of the
+				// shell's descriptors, the read end of this stage's own pipe among them,
+				// or tee would never see the reader go away
+				close_range(3, ~0U, 0);
+				_exit(runTeeStage(args, opts.pipeSize));
+			}
+			err = errno;
+			if (c_pid > 0 && ownGroup)
+				setpgid(c_pid, pids.empty() ? c_pid : pids[0]);
+		}
+		else {
+			Spawn_Actions actions;
+			if (ownGroup)
+				actions.setProcessGroup(pids.empty() ? 0 : pids[0]);
+			if (prevRead >= 0)
+				actions.dup2(prevRead, STDIN_FILENO);
+			if (p[1] >= 0)
+				actions.dup2(p[1], STDOUT_FILENO);
+			for (size_t r = 0; r < files.size(); r++)
+				actions.dup2(files[r], pipeline.redirects[i][r].fd);
+
+			const char* path = (i == 0 && firstPath != NULL) ? firstPath : args[0];
+			c_pid = spawnProcess(path, args, &actions, &err);
+		}
+
+		if (prevRead >= 0) close(prevRead);
+		if (p[1] >= 0) close(p[1]);
+		prevRead = p[0];
+
+		// Files to drop from the page cache stay open until the job exits
+		vector<int> cacheFds;
+		for (size_t r = 0; r < files.size(); r++) {
+			if (c_pid > 0 && pipeline.redirects[i][r].dontneed)
+				cacheFds.push_back(files[r]);
+			else
+				close(files[r]);
+		}
+
+		if (c_pid < 0) {
+			if (!opened)
+				continue;
+			if (err == EAGAIN || err == ENOMEM)
+				cout << OUT_INDENT << "Failed forking child.." << '\n';
+			else
+				cout << OUT_INDENT << "Could not open: " << args[0] << '\n';
+			continue;
+		}
+
+		Job* job = jobs.add(c_pid, joinArgs(args), foreground);
+		job->cacheFds = cacheFds;
+		job->pgid = !ownGroup ? shell_pgid : pids.empty() ? c_pid : pids[0];
+		pids.push_back(c_pid);
+		if (!foreground && !opts.quiet)
+			cout << OUT_INDENT << "PID: " << c_pid << '\n';
+	}
+
+	if (prevRead >= 0) close(prevRead);
+	return pids;
+}
+
+// Open the file of a redirection and apply its hints
+// Input: const Redirect& r - the redirection
+// Output: the open descriptor, or -1 if the file could not be opened
+int openRedirect(const Redirect& r) {
+	Trace_Span span("redirect_open");
+	int fd = open(r.path, r.flags | O_CLOEXEC, 0666);
+	if (fd < 0) {
+		cout << OUT_INDENT << "Could not open: " << r.path << ": " << strerror(errno) << '\n';
+		return -1;
+	}
+
+	if (r.sequential)
+		posix_fadvise(fd, 0, 0, POSIX_FADV_SEQUENTIAL);
+	if (r.noreuse)
+		posix_fadvise(fd, 0, 0, POSIX_FADV_NOREUSE);
+
+	// Reserve the space past the current end without changing the file size,
+	// so appends and truncated files both grow into it
+	if (r.prealloc > 0) {
+		off_t size = lseek(fd, 0, SEEK_END);
+		if (fallocate(fd, FALLOC_FL_KEEP_SIZE, max(size, (off_t)0), r.prealloc) < 0)
+			cout << OUT_INDENT << "Could not preallocate " << r.path << ": " << strerror(errno) << '\n';
+		if (!(r.flags & O_APPEND))
+			lseek(fd, 0, SEEK_SET);
+	}
+
+	return fd;
+}
+
+// Write back and drop from the page cache the files of a job's {dontneed} redirections
+// Input: Job& job - the job that exited
+void dropCachedFiles(Job& job) {
+	for (int fd: job.cacheFds) {
+		fdatasync(fd);
+		posix_fadvise(fd, 0, 0, POSIX_FADV_DONTNEED);
+		close(fd);
+	}
+	job.cacheFds.clear();
+}
+
+// Copy standard input to standard output and to a file, for a tee pipeline stage
+//     tee [-a] FILE
+// Input: char** args - the stage's arguments, long long pipeSize - size for the internal pipe
+// Output: int - exit status of the stage
+int runTeeStage(char** args, long long pipeSize) {
+	int flags = O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC;
+	int i = 1;
+	if (args[i] != NULL && strcmp(args[i], "-a") == 0) {
+		flags = O_WRONLY | O_CREAT | O_APPEND | O_CLOEXEC;
+		i++;
+	}
+	if (args[i] == NULL || args[i + 1] != NULL) {
+		cerr << "tee: expected one file" << endl;
+		return 1;
+	}
+
+	int file = open(args[i], flags, 0666);
+	if (file < 0) {
+		cerr << "tee: " << args[i] << ": " << strerror(errno) << endl;
+		return 1;
+	}
+
+	// tee(2) needs a pipe on both sides, so duplicate into an internal pipe
+	// when standard output is not one
+	struct stat st;
+	bool outPipe = fstat(STDOUT_FILENO, &st) == 0 && S_ISFIFO(st.st_mode);
+	int side[2] = {-1, -1};
+	if (!outPipe) {
+		if (pipe2(side, O_CLOEXEC) < 0) return 1;
+		if (pipeSize > 0) fcntl(side[1], F_SETPIPE_SZ, (int)pipeSize);
+	}
+
+	while (true) {
+		// Duplicate what is in the input pipe without consuming it
+		ssize_t n = tee(STDIN_FILENO, outPipe ? STDOUT_FILENO : side[1], TEE_CHUNK, 0);
+		if (n == 0) break;
+		if (n < 0) {
+			if (errno == EINTR) continue;
+			return 1;
+		}
+
+		// Then consume the same bytes into the file
+		if (!moveBytes(STDIN_FILENO, file, n)) return 1;
+		if (!outPipe && !moveBytes(side[0], STDOUT_FILENO, n)) return 1;
+	}
+
+	return 0;
+}
+
+// Move bytes out of a pipe with splice(2), or with read and write if the
+// destination does not support splicing
+// Input: int in - pipe to read from, int out - descriptor to write to, size_t n - bytes to move
+// Output: bool - True: all n bytes were moved
+bool moveBytes(int in, int out, size_t n) {
+	while (n > 0) {
+		ssize_t moved = splice(in, NULL, out, NULL, n, SPLICE_F_MOVE);
+		if (moved < 0 && errno == EINTR) continue;
+
+		if (moved < 0 && errno == EINVAL) {
+			char buffer[BUFFER_MAX * 64];
+			moved = read(in, buffer, min(n, sizeof(buffer)));
+			if (moved <= 0) return false;
+			for (ssize_t done = 0; done < moved; ) {
+				ssize_t w = write(out, buffer + done, moved - done);
+				if (w < 0 && errno == EINTR) continue;
+				if (w <= 0) return false;
+				done += w;
+			}
+		}
+		else if (moved <= 0)
+			return false;
+
+		n -= moved;
+	}
+	return true;
+}
+
+// Create a new process, add it to the job table, and print to console
+// Input: char** args - null terminated argument array, program first
+//		  const string& cmdLine - the command line recorded for the job
+// Output: the pid of the child process, or -1 if it could not be started
+pid_t launchBackground(char** args, const string& cmdLine, const Spawn_Options& opts) {
+	int err;
+	pid_t c_pid;
+
+	// The reaper collects the child once it exits
+	if (opts.placed())
+		c_pid = spawnPlaced(args[0], args, opts, &err);
+	else {
+		Spawn_Actions actions;
+		actions.setProcessGroup(0);
+		c_pid = spawnProcess(args[0], args, &actions, &err);
+	}
+
+	if (c_pid > 0) {
+		jobs.add(c_pid, cmdLine, false);
+		if (!opts.quiet)
+			cout << OUT_INDENT << "PID: " << c_pid << '\n';
+	}
+	else if (err == 0)
+		; // already reported by spawnPlaced
+	else if (err == EAGAIN || err == ENOMEM)
+		cout << OUT_INDENT << "Failed forking child.." << '\n';
+	else
+		cout << OUT_INDENT << "Could not open: " << args[0] << '\n';
+
+	return c_pid;
+}
+
+// Create a child process running a program without copying the shell's address space.
+// posix_spawn uses vfork semantics, so the parent is suspended only until the exec
+// and exec failures are reported back here instead of inside a forked copy of the shell.
+// Programs without a slash are found through the PATH cache, so the child execs
+// the full path instead of searching PATH again
+// Input: const char* path - program to run, searched in PATH if it has no slash
+//		  char** args - null terminated argument array
+//		  Spawn_Actions* actions - file actions and attributes for the child, or NULL
+//		  int* err - set to the error number if the child could not be started
+// Output: the pid of the child process, or -1 on failure
+pid_t spawnProcess(const char* path, char** args, Spawn_Actions* actions, int* err) {
+	pid_t c_pid;
+	Spawn_Actions defaults;
+
+	if (actions == NULL)
+		actions = &defaults;
+
+	Trace_Span lookup("path_lookup");
+	const char* fullPath = path_cache.lookup(path);
+	lookup.end();
+	if (fullPath == NULL) {
+		*err = ENOENT;
+		return -1;
+	}
+
+	Trace_Span span("spawn");
+	*err = posix_spawn(&c_pid, fullPath, &actions->actions, &actions->attr, args, environ);
+	if (*err != 0)
+		return -1;
+
+	span.setArg("pid", c_pid);
+	return c_pid;
+}
+
+// Start a program in its own process group with the placement given in the
+// options applied before it execs. clone3(CLONE_INTO_CGROUP) starts the child
+// in the cgroup directly; without it the child moves itself through cgroup.procs.
+// Whatever step fails in the child is sent back over a close-on-exec pipe
+// Input: const char* path - program to run, searched for in PATH if it has no slash,
+//		  char** args - null terminated arguments, const Spawn_Options& opts - the placement,
+//		  int* err - set to the errno of a failure to start, or 0 if the failure was printed
+// Output: pid_t - the pid of the child, or -1 if it could not be started
+pid_t spawnPlaced(const char* path, char** args, const Spawn_Options& opts, int* err) {
+	Trace_Span span("spawn_placed");
+	const char* fullPath = path_cache.lookup(path);
+	if (fullPath == NULL) {
+		*err = ENOENT;
+		return -1;
+	}
+
+	int report[2];
+	if (pipe2(report, O_CLOEXEC) < 0) {
+		*err = errno;
+		return -1;
+	}
+
+	struct clone_args cl = {};
+	cl.exit_signal = SIGCHLD;
+	if (opts.cgroupFd >= 0) {
+		cl.flags = CLONE_INTO_CGROUP;
+		cl.cgroup = opts.cgroupFd;
+	}
+
+	int procsFd = -1;
+	pid_t c_pid = syscall(SYS_clone3, &cl, sizeof(cl));
+	if (c_pid < 0 && errno != EAGAIN && errno != ENOMEM) {
+		// Older kernel, or a cgroup clone3 cannot start in
+		if (opts.cgroupFd >= 0)
+			procsFd = openat(opts.cgroupFd, "cgroup.procs", O_WRONLY | O_CLOEXEC);
+		if (opts.cgroupFd < 0 || procsFd >= 0)
+			c_pid = fork();
+	}
+
+	if (c_pid == 0) {
+		// Only async-signal-safe calls from here to exec
+		resetChildSignals();
+		setpgid(0, 0);
+
+		int failure[2] = {0, 0};
+		unsigned long nodes[16] = {};
+		if (procsFd >= 0 && write(procsFd, "0", 1) < 0)
+			failure[0] = 1;
+		else if (opts.pinned && sched_setaffinity(0, sizeof(opts.cpus), &opts.cpus) < 0)
+			failure[0] = 2;
+		else if (opts.numaNode >= 0) {
+			if (opts.numaNode >= (int)(sizeof(nodes) * CHAR_BIT)) {
+				errno = EINVAL;
+				failure[0] = 3;
+			} else {
+				nodes[opts.numaNode / (sizeof(long) * CHAR_BIT)] = 1UL << (opts.numaNode % (sizeof(long) * CHAR_BIT));
+				if (syscall(SYS_set_mempolicy, MPOL_BIND, nodes, sizeof(nodes) * CHAR_BIT) < 0)
+					failure[0] = 3;
+			}
+		}
+
+		if (failure[0] == 0) {
+			execv(fullPath, args);
+			failure[0] = 4;
+		}
+		failure[1] = errno;
+		ssize_t unused = write(report[1], failure, sizeof(failure));
+		(void)unused;
+		_exit(127);
+	}
+
+	*err = errno;
+	if (procsFd >= 0) close(procsFd);
+	close(report[1]);
+	if (c_pid < 0) {
+		if (opts.cgroupFd >= 0 && procsFd < 0) {
+			cout << OUT_INDENT << "Could not join cgroup " << opts.cgroup << ": " << strerror(*err) << '\n';
+			*err = 0;
+		}
+		close(report[0]);
+		return -1;
+	}
+
+	// Nothing is read once the exec succeeds and closes the pipe
+	int failure[2];
+	ssize_t n;
+	while ((n = read(report[0], failure, sizeof(failure))) < 0 && errno == EINTR);
+	close(report[0]);
+	if (n != sizeof(failure))
+		return c_pid;
+
+	while (waitpid(c_pid, NULL, 0) < 0 && errno == EINTR);
+	const char* steps[] = {"", "Could not join cgroup ", "Could not set CPU affinity", "Could not bind to NUMA node"};
+	if (failure[0] == 4) {
+		*err = failure[1];
+		return -1;
+	}
+	cout << OUT_INDENT << steps[failure[0]] << (failure[0] == 1 ? opts.cgroup : "") << ": " << strerror(failure[1]) << '\n';
+	*err = 0;
+	return -1;
+}
+
+// Get current location in directory
+void whereami() {
+	cout << work_dir.path << '\n';
+}
+
+// Move to the new specified directory
+// Input: const Command& cmd - Command containing movetodir
+// Output: bool - True: Successfully changed directores
+bool moveToDir(const Command& cmd) {
+	const char* arg = cmd.args[0].data();
+
+	int err = work_dir.change(arg);
+	if (err != 0) {
+		if (err == ENOENT || err == ENOTDIR)
+			cout << OUT_INDENT << "Directory " << arg << ": not found" << '\n';
+		else
+			cout << OUT_INDENT << "Directory " << arg << ": " << strerror(err) << '\n';
+		return false;
+	}
+
+	// Programs found through relative PATH entries are no longer where they were
+	path_cache.dirChanged();
+	completer.dirChanged();
+	return true;
+}
+
+// Terminate every job's process group at once, wait for all of them together,
+// and kill whatever is still running once the timeout passes. Each job is
+// signalled and watched through a pidfd, so a reused pid is never hit; the
+// reaper's signalfd is watched too, for jobs no pidfd could be opened for
+// Input: double timeout - seconds to wait after SIGTERM before sending SIGKILL
+void dalekallWait(double timeout) {
+	int epfd = epoll_create1(EPOLL_CLOEXEC);
+	if (epfd < 0) {
+		cout << OUT_INDENT << "Could not wait for processes: " << strerror(errno) << '\n';
+		return;
+	}
+
+	struct epoll_event ev = {};
+	ev.events = EPOLLIN;
+	ev.data.fd = reaper.fd;
+	epoll_ctl(epfd, EPOLL_CTL_ADD, reaper.fd, &ev);
+
+	vector<pid_t> pids;
+	vector<string> cmdLines;
+	vector<int> pidfds;
+	vector<pid_t> groups;						// Process groups already signalled
+	for (Job& job: jobs) {
+		int fd = syscall(SYS_pidfd_open, job.pid, 0);
+		if (fd >= 0) {
+			ev.data.fd = fd;
+			epoll_ctl(epfd, EPOLL_CTL_ADD, fd, &ev);
+		}
+		pids.push_back(job.pid);
+		cmdLines.push_back(job.cmdLine);
+		pidfds.push_back(fd);
+	}
+
+	cout << OUT_INDENT << "Exterminating " << pids.size() << " processes, waiting up to "
+		<< timeout << "s\n" << flush;
+	for (size_t i = 0; i < pids.size(); i++)
+		signalJob(pidfds[i], pids[i], SIGTERM, &groups);
+
+	// Wait for every job, first until the timeout, then briefly after SIGKILL
+	vector<bool> killed(pids.size(), false);
+	unordered_map<pid_t, int> statuses;			// Status of each job reaped, as the exit log may drop it
+	struct epoll_event events[64];
+	for (int round = 0; round < 2; round++) {
+		struct timespec now, deadline;
+		clock_gettime(CLOCK_MONOTONIC, &deadline);
+		long long ms = round == 0 ? (long long)(timeout * 1000) : KILL_GRACE_MS;
+		deadline.tv_sec += ms / 1000;
+		deadline.tv_nsec += (ms % 1000) * 1000000;
+
+		while (true) {
+			for (const Child_Exit& ex: reaper.reap()) {
+				if (!WIFSTOPPED(ex.status) && !WIFCONTINUED(ex.status))
+					statuses[ex.pid] = ex.status;
+				recordExit(ex);
+			}
+			bool running = false;
+			for (pid_t pid: pids)
+				running = running || jobs.find(pid) != NULL;
+			if (!running) break;
+
+			clock_gettime(CLOCK_MONOTONIC, &now);
+			long long left = (deadline.tv_sec - now.tv_sec) * 1000 + (deadline.tv_nsec - now.tv_nsec) / 1000000;
+			if (left <= 0) break;
+			if (epoll_wait(epfd, events, 64, left) < 0 && errno != EINTR) break;
+		}
+
+		if (round == 1) break;
+
+		// Stragglers get SIGKILL
+		groups.clear();
+		for (size_t i = 0; i < pids.size(); i++) {
+			if (jobs.find(pids[i]) != NULL) {
+				killed[i] = true;
+				signalJob(pidfds[i], pids[i], SIGKILL, &groups);
+			}
+		}
+	}
+
+	// Report each job
+	for (size_t i = 0; i < pids.size(); i++) {
+		cout << OUT_INDENT << pids[i] << "  ";
+		unordered_map<pid_t, int>::iterator it = statuses.find(pids[i]);
+		if (it == statuses.end())
+			cout << "Still running";
+		else if (WIFSIGNALED(it->second))
+			cout << "Killed(" << WTERMSIG(it->second) << ")";
+		else
+			cout << "Done(" << WEXITSTATUS(it->second) << ")";
+		if (killed[i])
+			cout << " after timeout";
+		cout << "  " << cmdLines[i] << '\n';
+
+		if (pidfds[i] >= 0) close(pidfds[i]);
+	}
+	close(epfd);
+}
+
+// Send a signal to a job's process group, or to the job alone if it shares the shell's group
+// Input: int pidfd - pidfd of the job, or -1, pid_t pid - pid of the job, int sig - the signal,
+//		  vector<pid_t>* groups - groups already signalled, the job's group is added
+// Output: bool - True: the signal was sent
+bool signalJob(int pidfd, pid_t pid, int sig, vector<pid_t>* groups) {
+	pid_t pgid = getpgid(pid);
+	if (pgid < 0 || pgid == getpgrp()) {
+		if (pidfd >= 0)
+			return syscall(SYS_pidfd_send_signal, pidfd, sig, NULL, 0) == 0;
+		return kill(pid, sig) == 0;
+	}
+
+	// Every stage of a pipeline is in the group of the first one
+	for (pid_t g: *groups)
+		if (g == pgid) return true;
+	groups->push_back(pgid);
+
+	// Older kernels have no group signal through a pidfd
+	bool sent;
+	if (pidfd >= 0 && pgid == pid && syscall(SYS_pidfd_send_signal, pidfd, sig, NULL, PIDFD_SIGNAL_PROCESS_GROUP) == 0)
+		sent = true;
+	else
+		sent = kill(-pgid, sig) == 0;
+
+	// A stopped group only acts on the signal once continued
+	if (sent && sig != SIGKILL)
+		kill(-pgid, SIGCONT);
+	return sent;
+}
+
+// Parse a duration such as 5s, 250ms or 2m, in seconds if no unit is given
+// Input: string_view s - the duration, double* seconds - set to the duration in seconds
+// Output: bool - True: s was a valid duration
+bool parseDuration(string_view s, double* seconds) {
+	double scale = 1;
+	if (s.size() > 2 && s.substr(s.size() - 2) == "ms") {
+		scale = 0.001;
+		s.remove_suffix(2);
+	}
+	else if (!s.empty() && (s.back() == 's' || s.back() == 'm')) {
+		scale = (s.back() == 'm') ? 60 : 1;
+		s.remove_suffix(1);
+	}
+
+	int n;
+	if (!parseCount(s, &n)) return false;
+	*seconds = n * scale;
+	return true;
+}
+
+// Join a null terminated argument array into one command line
+// Input: char** args - the arguments
+// Output: string - the arguments separated by spaces
+string joinArgs(char** args) {
+	string cmdLine;
+	for (int i = 0; args[i] != NULL; i++) {
+		if (i > 0) cmdLine += " ";
+		cmdLine += args[i];
+	}
+	return cmdLine;
+}
+
+// Parse a size argument with an optional K, M or G suffix
+// Input: string_view s - the argument, long long* n - set to the size in bytes
+// Output: bool - True: s was a valid size
+bool parseSize(string_view s, long long* n) {
+	long long val;
+	from_chars_result res = from_chars(s.data(), s.data() + s.size(), val);
+	if (s.empty() || res.ec != errc() || val < 0)
+		return false;
+
+	string_view suffix = s.substr(res.ptr - s.data());
+	int shift = 0;
+	if (suffix == "K" || suffix == "k") shift = 10;
+	else if (suffix == "M" || suffix == "m") shift = 20;
+	else if (suffix == "G" || suffix == "g") shift = 30;
+	else if (!suffix.empty()) return false;
+
+	if (val > (LLONG_MAX >> shift)) return false;
+	*n = val << shift;
+	return true;
+}
+
+// Parse a non-negative count argument
+// Input: string_view s - the argument, int* n - set to the count
+// Output: bool - True: s was a valid count
+bool parseCount(string_view s, int* n) {
+	int val;
+	from_chars_result res = from_chars(s.data(), s.data() + s.size(), val);
+	if (s.empty() || res.ec != errc() || res.ptr != s.data() + s.size() || val < 0)
+		return false;
+
+	*n = val;
+	return true;
+}
+
+// Check if help was entered. If so, print command list
+// Input: const Command& cmd - Command to check if help was input
+// Output: bool - true if help entered
+bool getHelp(const Command& cmd) {
+	if (cmd.cmdInput == "help") {
+		cout << '\n';
+		cout << OUT_INDENT << "The following are valid commands:" << '\n';
+
+		for (const Builtin& b: BUILTINS)
+			cout << OUT_INDENT << b.help << '\n';
+
+		cout << '\n';
+		return true;
+	}
+
+	return false;
+}
+
+// Print out message at program start
+void introMessage() {
+	cout << "\t\t===== Welcome to my shell =====" << '\n';
+	cout << "Type \"help\" to list valid commands\n" << '\n';
+}
+
+// Record the time from launch to the first prompt
+// Printed to stderr when the MYSH_METRICS environment variable is set
+void recordFirstPrompt() {
+	struct timespec now;
+	clock_gettime(CLOCK_MONOTONIC, &now);
+	metrics.firstPromptMs = (now.tv_sec - metrics.launched.tv_sec) * 1e3
+		+ (now.tv_nsec - metrics.launched.tv_nsec) / 1e6;
+
+	if (getenv("MYSH_METRICS") != NULL)
+		cerr << "time to first prompt: " << metrics.firstPromptMs << " ms" << endl;
+}
+
+// Get input from the shell console
+// Output: string - the line read, or byebye once the input has ended
+string getInput() {
+	string line;
+	
+	// Input may already be buffered, so collect exited children before reading it
+	reapChildren();
+	if (reaper.interrupts > 0 && !input.interactive)
+		return "byebye";
+
+	if (!input.interactive) {
+		while (!input.getLine(line)) {
+			if (input.eof || !waitForInput())
+				return "byebye";
+		}
+		return line;
+	}
+
+	for (const string& notice: job_notices)
+		cout << notice << '\n';
+	job_notices.clear();
+
+	// Edit the line in raw mode, one key at a time
+	editor.begin("# ", shell_tmodes);
+	if (metrics.firstPromptMs < 0)
+		recordFirstPrompt();
+
+	int result = edit_more;
+	while (result == edit_more) {
+		char c;
+		while (result == edit_more && input.getChar(&c))
+			result = editor.feed(c);
+		if (result == edit_more && (input.eof || !waitForInput()))
+			result = edit_eof;
+	}
+	editor.end(shell_tmodes);
+
+	if (result == edit_eof)
+		return "byebye";
+	return editor.line;
+}
+
+// Serve commands over a Unix socket until SIGINT. Each request is a frame of a
+// 4 byte length in network order followed by a command line. Each reply is a
+// frame holding a reply_codes byte followed by the output of the command.
+// Only built-ins marked daemonSafe are run, with the shell's job table shared
+// by every client; programs started keep the daemon's stdout and stderr
+// Input: const char* path - the socket to create
+// Output: int - the exit status of the shell
+int runDaemon(const char* path) {
+	int listenFd = openDaemonSocket(path);
+	if (listenFd < 0) return 1;
+
+	struct epoll_event ev = {};
+	ev.events = EPOLLIN;
+	ev.data.fd = listenFd;
+	epoll_ctl(events_fd, EPOLL_CTL_ADD, listenFd, &ev);
+
+	unordered_map<int, Daemon_Client> clients;
+	struct epoll_event events[64];
+	int seen = reaper.interrupts;
+
+	while (reaper.interrupts == seen) {
+		cout.flush();
+		int n = epoll_wait(events_fd, events, 64, -1);
+		if (n < 0) {
+			if (errno == EINTR) continue;
+			break;
+		}
+
+		for (int i = 0; i < n; i++) {
+			int fd = events[i].data.fd;
+			if (fd == reaper.fd) {
+				reapChildren();
+				continue;
+			}
+
+			if (fd == listenFd) {
+				int clientFd;
+				while ((clientFd = accept4(listenFd, NULL, NULL, SOCK_NONBLOCK | SOCK_CLOEXEC)) >= 0) {
+					ev.events = EPOLLIN;
+					ev.data.fd = clientFd;
+					epoll_ctl(events_fd, EPOLL_CTL_ADD, clientFd, &ev);
+					clients[clientFd] = {clientFd, "", "", false, false};
+				}
+				continue;
+			}
+
+			unordered_map<int, Daemon_Client>::iterator it = clients.find(fd);
+			if (it == clients.end()) continue;
+			Daemon_Client& client = it->second;
+
+			bool open = true;
+			if (events[i].events & (EPOLLIN | EPOLLHUP | EPOLLERR))
+				open = readClient(client);
+			if (open)
+				open = writeClient(client);
+
+			if (!open || (client.closing && client.out.empty())) {
+				close(fd); // also leaves the epoll set
+				clients.erase(it);
+				continue;
+			}
+
+			// Only wait for room to write while replies are left over, and stop
+			// reading once the client has shut down its end
+			bool writing = !client.out.empty();
+			if (writing != client.writing || client.closing) {
+				client.writing = writing;
+				ev.events = (client.closing ? 0u : (uint32_t)EPOLLIN) | (writing ? (uint32_t)EPOLLOUT : 0u);
+				ev.data.fd = fd;
+				epoll_ctl(events_fd, EPOLL_CTL_MOD, fd, &ev);
+			}
+		}
+	}
+
+	for (auto& entry: clients)
+		close(entry.first);
+	close(listenFd);
+	unlink(path);
+	return 0;
+}
+
+// Create the listening socket of the daemon, replacing a stale one left by
+// a daemon that is no longer running. The socket is only usable by its owner
+// Input: const char* path - the socket
+// Output: int - the listening descriptor, or -1 if it could not be created
+int openDaemonSocket(const char* path) {
+	struct sockaddr_un addr = {};
+	addr.sun_family = AF_UNIX;
+	if (strlen(path) >= sizeof(addr.sun_path)) {
+		cout << OUT_INDENT << "Socket path too long: " << path << '\n';
+		return -1;
+	}
+	strcpy(addr.sun_path, path);
+
+	int fd = socket(AF_UNIX, SOCK_STREAM | SOCK_NONBLOCK | SOCK_CLOEXEC, 0);
+	if (fd < 0) {
+		cout << OUT_INDENT << "Could not create socket: " << strerror(errno) << '\n';
+		return -1;
+	}
+
+	mode_t mask = umask(077);
+	int bound = bind(fd, (struct sockaddr*)&addr, sizeof(addr));
+	if (bound < 0 && errno == EADDRINUSE) {
+		// Only take the path over if nothing answers on it
+		int probe = socket(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0);
+		bool stale = probe >= 0 && connect(probe, (struct sockaddr*)&addr, sizeof(addr)) < 0 && errno == ECONNREFUSED;
+		if (probe >= 0) close(probe);
+		if (stale && unlink(path) == 0)
+			bound = bind(fd, (struct sockaddr*)&addr, sizeof(addr));
+		else
+			errno = EADDRINUSE;
+	}
+	umask(mask);
+
+	if (bound < 0 || listen(fd, SOMAXCONN) < 0) {
+		cout << OUT_INDENT << "Could not listen on " << path << ": " << strerror(errno) << '\n';
+		close(fd);
+		return -1;
+	}
+	return fd;
+}
+
+// Read what a client sent and run each whole request in it. Requests that
+// arrived before the client shut down its end are still answered
+// Input: Daemon_Client& client - the client, its replies added to client.out
+// Output: bool - False: reading failed or the client sent a bad frame
+bool readClient(Daemon_Client& client) {
+	char buf[BUFFER_MAX * 16];
+	while (true) {
+		ssize_t n = read(client.fd, buf, sizeof(buf));
+		if (n == 0) {
+			client.closing = true;
+			break;
+		}
+		if (n < 0) {
+			if (errno == EINTR) continue;
+			if (errno == EAGAIN) break;
+			return false;
+		}
+		client.in.append(buf, n);
+	}
+
+	// Run every whole frame received
+	size_t pos = 0;
+	while (client.in.size() - pos >= 4) {
+		uint32_t len;
+		memcpy(&len, client.in.data() + pos, 4);
+		len = ntohl(len);
+		if (len > DAEMON_FRAME_MAX) return false;
+		if (client.in.size() - pos - 4 < len) break;
+
+		int code;
+		string output = runRemote(string_view(client.in).substr(pos + 4, len), &code);
+		uint32_t replyLen = htonl(output.size() + 1);
+		client.out.append((const char*)&replyLen, 4);
+		client.out += (char)code;
+		client.out += output;
+		pos += 4 + len;
+	}
+	client.in.erase(0, pos);
+	return true;
+}
+
+// Write as much of the pending replies as the socket takes
+// Input: Daemon_Client& client - the client
+// Output: bool - False: the connection failed
+bool writeClient(Daemon_Client& client) {
+	size_t done = 0;
+	while (done < client.out.size()) {
+		ssize_t n = send(client.fd, client.out.data() + done, client.out.size() - done, MSG_NOSIGNAL);
+		if (n < 0) {
+			if (errno == EINTR) continue;
+			if (errno == EAGAIN) break;
+			return false;
+		}
+		done += n;
+	}
+	client.out.erase(0, done);
+	return true;
+}
+
+// Run a command line sent to the daemon, collecting what it prints
+// Input: string_view line - the command line, int* code - set to a reply_codes value
+// Output: string - the output of the command
+string runRemote(string_view line, int* code) {
+	Trace_Span parse("parse");
+	Command cmd{string(line)};
+	parse.end();
+
+	// Send what the command prints into the reply
+	ostringstream captured;
+	cout.flush();
+	streambuf* shellOut = cout.rdbuf(captured.rdbuf());
+
+	*code = reply_ok;
+	if (cmd.numTokens == 0 || getHelp(cmd))
+		;
+	else if (!cmd.validCmd()) {
+		*code = reply_invalid;
+		cout << OUT_INDENT << "Invalid command: " << cmd.cmdInput << '\n';
+	}
+	else if (!BUILTINS[cmd.commandNum].daemonSafe || (cmd.commandNum == repeat_sym && cmd.args[0] == "-j") ||
+			(cmd.commandNum == dalekall_sym && cmd.hasArgs())) {
+		// These wait on the terminal or on jobs, which would stall every other client
+		*code = reply_refused;
+		cout << OUT_INDENT << "Not available from the daemon: " << BUILTINS[cmd.commandNum].name << '\n';
+	}
+	else if (!executeCommand(cmd))
+		*code = reply_failed;
+
+	cout.rdbuf(shellOut);
+	return captured.str();
+}